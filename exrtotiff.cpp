@@ -1,187 +1,1285 @@
 // This file is in the public domain.
-#include <ImfInputFile.h>
-#include <ImfOutputFile.h>
-#include <ImfChannelList.h>
+#include "exrtotiff.h"
+#include "threadpool.h"
 #include "tiffio.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <limits.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <signal.h>
 #include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 using namespace std;
-using namespace Imf;
-using namespace Imath;
-
-void convert(string input_filename, string output_filename)
-{
-    // This function exits abruptly if it can't open the file.  This isn't a very good library.
-    InputFile file(input_filename.c_str());
-
-    Box2i dw = file.header().dataWindow();
-    int width  = dw.max.x - dw.min.x + 1;
-    int height = dw.max.y - dw.min.y + 1;
-
-    // Request all of the channels from the EXR in the correct order.  We always request
-    // in FLOAT, which will convert 16-bit floats to 32-bit for us, since 16-bit floats
-    // are rarely supported.  This will also convert 32-bit ints, which isn't ideal,
-    // but that's less commonly used.
-    //
-    // It would be easy to request multiple alpha channels and output them to more EXTRASAMPLES,
-    // but without use cases we won't know what to do with them, so for now just handle regular
-    // alpha.
-    FrameBuffer frameBuffer;
-    map<string, vector<float> > channel_data;
-    for(auto it = file.header().channels().begin(); it != file.header().channels().end(); ++it)
-    {
-        string channel_name = it.name();
-
-        vector<float> &buf = channel_data[channel_name];
-        buf.resize(height*width, 1);
-
-        frameBuffer.insert(channel_name.c_str(), Slice(FLOAT, (char *) &buf[0], 4 /* bytes */, sizeof(4) * width, 1, 1, 0.0));
-    }
-
-    // Map from input channels to output channels.  For example, NX/NY/NZ in a normal
-    // map image is mapped to RGB.
-    map<string,string> channel_map = {
-        { "Z", "Y" },
-        { "Y", "Y" },
-        { "R", "R" },
-        { "G", "G" },
-        { "B", "B" },
-        { "NX", "R" },
-        { "NY", "G" },
-        { "NZ", "B" },
-        { "A", "A" },
-    };
+using namespace exrtotiff;
 
-    bool convert_normals = false;
-    
-    // Make a map from output channels to input channels.
-    map<string, string> channel_names;
-    for(auto it = file.header().channels().begin(); it != file.header().channels().end(); ++it)
-    {
-        // The channel name looks like "ABC:def.NX".  Pull out the value after the period,
-        // or the whole string if there's no period.
-        string channel_name = it.name();
-        size_t idx = channel_name.find_last_of('.');
-        if(idx != channel_name.npos)
-            channel_name = channel_name.substr(idx+1);
+// One file to convert.
+struct Job
+{
+    string input_filename, output_filename;
+
+    // If true, the input file doesn't exist and the job isn't run.
+    bool missing = false;
+
+    // Set by run_jobs.
+    bool success = false;
+    string error;
+};
+
+// Convert a list of files, running up to job_threads conversions at once.  Each
+// conversion still uses the shared decode and encode thread pools.
+static void run_jobs(vector<Job> &jobs, const ConvertOptions &options, int job_threads)
+{
+    if(jobs.empty())
+        return;
+
+    ThreadPool pool(min(job_threads, (int) jobs.size()));
+    pool.parallel_for(jobs.size(), [&](int i) {
+        Job &job = jobs[i];
+        if(job.missing)
+            return;
 
-        // If this is a normals channel, set convert_normals.
-        if(channel_name == "NX")
-            convert_normals = true;
+        try {
+            convert(job.input_filename, job.output_filename, options);
+            job.success = true;
+        } catch(exception &e) {
+            job.error = e.what();
+        }
+    });
+}
 
-        if(channel_map.find(channel_name) == channel_map.end())
+// Print the result of each job, and return the number that failed.
+static int print_summary(const vector<Job> &jobs)
+{
+    int failures = 0;
+    for(const Job &job: jobs)
+    {
+        if(job.success)
+            fprintf(stderr, "ok      %s -> %s\n", job.input_filename.c_str(), job.output_filename.c_str());
+        else if(job.missing)
         {
-            fprintf(stderr, "Unknown channel: %s\n", channel_name.c_str());
-            continue;
+            fprintf(stderr, "MISSING %s\n", job.input_filename.c_str());
+            failures++;
+        }
+        else
+        {
+            fprintf(stderr, "FAILED  %s -> %s: %s\n", job.input_filename.c_str(), job.output_filename.c_str(), job.error.c_str());
+            failures++;
         }
+    }
 
-        string new_name = channel_map[channel_name];
+    fprintf(stderr, "%i of %i files converted\n", int(jobs.size()) - failures, int(jobs.size()));
+    return failures;
+}
 
-        if(channel_names.find(new_name) != channel_names.end())
+// Read a --list file.  Each line has an input and output filename, separated by a tab,
+// or by whitespace if the line has no tabs.  Blank lines and lines starting with #
+// are ignored.
+static bool read_job_list(const string &filename, vector<Job> &jobs)
+{
+    ifstream file(filename);
+    if(!file)
+    {
+        fprintf(stderr, "Couldn't open %s\n", filename.c_str());
+        return false;
+    }
+
+    string line;
+    int line_number = 0;
+    while(getline(file, line))
+    {
+        line_number++;
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.find_first_not_of(" \t") == line.npos || line[0] == '#')
+            continue;
+
+        const char *separators = line.find('\t') != line.npos? "\t": " \t";
+        size_t end = line.find_first_of(separators);
+        size_t start = line.find_first_not_of(separators, end);
+        if(end == line.npos || start == line.npos)
         {
-            fprintf(stderr, "More than one channel was found that maps to the output channel %s.\n", new_name.c_str());
-            exit(1);
+            fprintf(stderr, "%s:%i: expected an input and output filename\n", filename.c_str(), line_number);
+            return false;
         }
 
-        // As a special case, convert "Y" (monochrome) to R, G, B output channels.  Maya doesn't
-        // seem to support 32-bit monochrome TIFFs.
-        if(new_name == "Y")
+        Job job;
+        job.input_filename = line.substr(0, end);
+        job.output_filename = line.substr(start);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Parse a list of frame ranges, like "1001-1240", "1001-1240x2" or "1,5,10-20", and add
+// the frames to result.  Return false if the list can't be parsed.
+static bool parse_frame_ranges(const string &value, set<int> &result)
+{
+    size_t pos = 0;
+    while(pos <= value.size())
+    {
+        size_t end = value.find(',', pos);
+        if(end == value.npos)
+            end = value.size();
+        string range = value.substr(pos, end - pos);
+        pos = end + 1;
+
+        int first, last, step = 1;
+        char extra;
+        if(sscanf(range.c_str(), "%d-%dx%d%c", &first, &last, &step, &extra) == 3 ||
+            sscanf(range.c_str(), "%d-%d%c", &first, &last, &extra) == 2)
         {
-            channel_names["R"] = it.name();
-            channel_names["G"] = it.name();
-            channel_names["B"] = it.name();
+            if(step <= 0 || last < first)
+                return false;
         }
+        else if(sscanf(range.c_str(), "%d%c", &first, &extra) == 1)
+            last = first;
         else
+            return false;
+
+        for(int frame = first; frame <= last; frame += step)
+            result.insert(frame);
+    }
+    return true;
+}
+
+// Return true if filename contains a frame number pattern: a run of #, with one # per
+// digit, or a printf-style %d or %04d.
+static bool is_frame_pattern(const string &filename)
+{
+    if(filename.find('#') != filename.npos)
+        return true;
+
+    size_t percent = filename.find('%');
+    if(percent == filename.npos)
+        return false;
+    size_t d = filename.find_first_not_of("0123456789", percent + 1);
+    return d != filename.npos && filename[d] == 'd';
+}
+
+// Replace the frame number patterns in filename with frame.
+static string expand_frame_pattern(const string &filename, int frame)
+{
+    string result;
+    for(size_t i = 0; i < filename.size(); )
+    {
+        int padding = -1;
+        size_t length = 0;
+        if(filename[i] == '#')
+        {
+            size_t end = filename.find_first_not_of('#', i);
+            if(end == filename.npos)
+                end = filename.size();
+            length = end - i;
+            padding = length;
+        }
+        else if(filename[i] == '%')
         {
-            // Store the channel that we'll get this output channel from.  Use the whole layer name,
-            // not just the data type portion that we parsed out.
-            channel_names[new_name] = it.name();
+            size_t d = filename.find_first_not_of("0123456789", i + 1);
+            if(d != filename.npos && filename[d] == 'd')
+            {
+                length = d + 1 - i;
+                padding = atoi(filename.substr(i + 1, d - i - 1).c_str());
+            }
         }
+
+        if(padding == -1)
+        {
+            result += filename[i++];
+            continue;
+        }
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%0*d", padding, frame);
+        result += buf;
+        i += length;
+    }
+    return result;
+}
+
+static bool file_exists(const string &filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0;
+}
+
+// Return true if filename ends in .exr, ignoring case.
+static bool is_exr_filename(const string &filename)
+{
+    return filename.size() > 4 && strcasecmp(filename.c_str() + filename.size() - 4, ".exr") == 0;
+}
+
+// Return the output filename for an EXR found in a watched directory: the same name with
+// a .tif extension, in output_dir if it's set or alongside the input otherwise.
+static string watch_output_filename(const string &input_filename, const string &output_dir)
+{
+    string output_filename = input_filename.substr(0, input_filename.size() - 4) + ".tif";
+    if(output_dir.empty())
+        return output_filename;
+
+    size_t slash = output_filename.find_last_of('/');
+    if(slash != output_filename.npos)
+        output_filename = output_filename.substr(slash + 1);
+    return output_dir + "/" + output_filename;
+}
+
+#ifdef __linux__
+// Remove a directory and the files in it.
+static void remove_directory(const string &dir)
+{
+    if(DIR *d = opendir(dir.c_str()))
+    {
+        while(dirent *entry = readdir(d))
+        {
+            if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                unlink((dir + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
     }
+    rmdir(dir.c_str());
+}
+
+// Convert a file into a temporary directory beside its output, then rename the results
+// into place, so anything watching the output directory never sees a partly written TIFF.
+// This uses a directory rather than a temporary filename, since splitting parts or layers
+// writes more than one file.  It's in the same directory as the output, so the renames
+// don't cross filesystems.
+static void convert_and_rename(const string &input_filename, const string &output_filename, const ConvertOptions &options)
+{
+    size_t slash = output_filename.find_last_of('/');
+    string dir = slash == output_filename.npos? ".": output_filename.substr(0, slash);
+    string name = slash == output_filename.npos? output_filename: output_filename.substr(slash + 1);
+
+    string temp_template = dir + "/.exrtotiff-XXXXXX";
+    vector<char> temp_buf(temp_template.begin(), temp_template.end());
+    temp_buf.push_back(0);
+    if(mkdtemp(&temp_buf[0]) == NULL)
+        throw runtime_error("Couldn't create a temporary directory in " + dir + ": " + strerror(errno));
+    string temp_dir = &temp_buf[0];
+
+    try {
+        convert(input_filename, temp_dir + "/" + name, options);
+
+        DIR *d = opendir(temp_dir.c_str());
+        if(d == NULL)
+            throw runtime_error("Couldn't read " + temp_dir + ": " + strerror(errno));
+        string error;
+        while(dirent *entry = readdir(d))
+        {
+            if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            string target = dir + "/" + entry->d_name;
+            if(rename((temp_dir + "/" + entry->d_name).c_str(), target.c_str()) == -1 && error.empty())
+                error = "Couldn't rename output to " + target + ": " + strerror(errno);
+        }
+        closedir(d);
+        if(!error.empty())
+            throw runtime_error(error);
+    } catch(...) {
+        remove_directory(temp_dir);
+        throw;
+    }
+    remove_directory(temp_dir);
+}
 
-    vector<vector<float> *> output_channels;
-    for(string channel_name: {"R", "G", "B", "A"})
+// Queue every EXR in the watched directories whose output is missing or older than it.
+// This runs at startup, and again if inotify's queue overflows and we lose events.
+static void scan_directories(const vector<string> &dirs, const string &output_dir, const function<void(const string &)> &queue_file)
+{
+    for(const string &dir: dirs)
     {
-        if(channel_names.find(channel_name) == channel_names.end())
+        DIR *d = opendir(dir.c_str());
+        if(d == NULL)
             continue;
 
-        string input_channel_name = channel_names.at(channel_name);
-        output_channels.push_back(&channel_data.at(input_channel_name));
+        while(dirent *entry = readdir(d))
+        {
+            string input_filename = dir + "/" + entry->d_name;
+            if(!is_exr_filename(input_filename))
+                continue;
+
+            struct stat input_st, output_st;
+            if(stat(input_filename.c_str(), &input_st) == -1 || !S_ISREG(input_st.st_mode))
+                continue;
+            string output_filename = watch_output_filename(input_filename, output_dir);
+            if(stat(output_filename.c_str(), &output_st) == 0 && output_st.st_mtime >= input_st.st_mtime)
+                continue;
+            queue_file(input_filename);
+        }
+        closedir(d);
+    }
+}
+
+// Watch directories for EXRs and convert them as they're written, until we're killed.
+//
+// A file is converted when the writer closes it, or when it's moved into the directory.
+// Files that are written without being closed, such as by a writer that holds the file
+// open, are converted once they haven't been modified for settle_seconds.  EXRs that are
+// already in the directories when we start are converted if their output is missing or
+// older than the input.
+//
+// Outputs are written under a temporary name and renamed into place when they're
+// complete.  A file is never converted by two jobs at once: if it's queued again while
+// it's being converted, it's converted again once the current job finishes.
+static int watch(const vector<string> &dirs, const string &output_dir, const ConvertOptions &options, int job_threads, int settle_seconds)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd == -1)
+    {
+        fprintf(stderr, "inotify_init1: %s\n", strerror(errno));
+        return 1;
+    }
+
+    map<int, string> watched_dirs;
+    for(const string &dir: dirs)
+    {
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+        if(wd == -1)
+        {
+            fprintf(stderr, "Couldn't watch %s: %s\n", dir.c_str(), strerror(errno));
+            close(fd);
+            return 1;
+        }
+        watched_dirs[wd] = dir;
     }
 
-    // Read the data for each channel.
-    file.setFrameBuffer(frameBuffer);
-    file.readPixels(dw.min.y, dw.max.y);
+    // The inputs being converted, and whether each has been queued again since its job
+    // started.
+    mutex in_flight_lock;
+    map<string, bool> in_flight;
+
+    // The pool stays running, so conversions don't pay any startup cost.
+    ThreadPool pool(job_threads);
+    auto queue_file = [&](const string &input_filename) {
+        {
+            lock_guard<mutex> guard(in_flight_lock);
+            auto it = in_flight.find(input_filename);
+            if(it != in_flight.end())
+            {
+                it->second = true;
+                return;
+            }
+            in_flight[input_filename] = false;
+        }
 
-    // On error, TIFFOpen prints an error.
-    TIFF *tif = TIFFOpen(output_filename.c_str(), "w");
-    if(tif == NULL)
-        throw runtime_error("Error opening output file.");
+        string output_filename = watch_output_filename(input_filename, output_dir);
+        pool.run([&options, &in_flight_lock, &in_flight, input_filename, output_filename] {
+            while(true)
+            {
+                try {
+                    convert_and_rename(input_filename, output_filename, options);
+                    fprintf(stderr, "ok      %s -> %s\n", input_filename.c_str(), output_filename.c_str());
+                } catch(exception &e) {
+                    fprintf(stderr, "FAILED  %s -> %s: %s\n", input_filename.c_str(), output_filename.c_str(), e.what());
+                }
 
-    int channels = output_channels.size();
-    bool has_alpha = channel_names.find("A") != channel_names.end();
-    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
-    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
-    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
-    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, channels);
-    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 32);
-    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 1);
+                // If the file was queued again while we were converting it, it may have
+                // changed, so convert it again.
+                lock_guard<mutex> guard(in_flight_lock);
+                auto it = in_flight.find(input_filename);
+                if(!it->second)
+                {
+                    in_flight.erase(it);
+                    return;
+                }
+                it->second = false;
+            }
+        });
+    };
 
-    // We have RGB data if we have three color channels.
-    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (channels - has_alpha) == 3? PHOTOMETRIC_RGB:PHOTOMETRIC_MINISBLACK);
-    if(has_alpha)
+    scan_directories(dirs, output_dir, queue_file);
+
+    // Files that have been created or modified but not closed, and when they were last
+    // modified.
+    map<string, chrono::steady_clock::time_point> pending;
+
+    vector<char> buf(64*1024);
+    while(true)
     {
-        uint16 data[] = {
-            EXTRASAMPLE_ASSOCALPHA
-        };
+        pollfd pfd = { fd, POLLIN, 0 };
+        if(poll(&pfd, 1, 1000) == -1 && errno != EINTR)
+        {
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+
+        if(pfd.revents & POLLIN)
+        {
+            ssize_t bytes = read(fd, &buf[0], buf.size());
+            for(ssize_t pos = 0; pos < bytes; )
+            {
+                const inotify_event *event = (const inotify_event *) &buf[pos];
+                pos += sizeof(inotify_event) + event->len;
+
+                // If the kernel's event queue filled up, events were dropped, so look for
+                // anything we missed.
+                if(event->mask & IN_Q_OVERFLOW)
+                {
+                    fprintf(stderr, "inotify queue overflowed, rescanning\n");
+                    scan_directories(dirs, output_dir, queue_file);
+                    continue;
+                }
+
+                if(event->len == 0 || !watched_dirs.count(event->wd))
+                    continue;
+
+                string input_filename = watched_dirs[event->wd] + "/" + event->name;
+                if(!is_exr_filename(input_filename))
+                    continue;
 
-        TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, data);
+                if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                {
+                    pending.erase(input_filename);
+                    queue_file(input_filename);
+                }
+                else
+                    pending[input_filename] = chrono::steady_clock::now();
+            }
+        }
+
+        auto now = chrono::steady_clock::now();
+        for(auto it = pending.begin(); it != pending.end(); )
+        {
+            if(now - it->second < chrono::seconds(settle_seconds))
+            {
+                ++it;
+                continue;
+            }
+
+            if(file_exists(it->first))
+                queue_file(it->first);
+            it = pending.erase(it);
+        }
     }
 
-    // Maya doesn't support COMPRESSION_DEFLATE.
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+    close(fd);
+    return 1;
+}
+#endif
+
+// This goes to stderr, since with - as the output filename, stdout is the TIFF.
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [options] input.exr output.tif\n", argv0);
+    fprintf(stderr, "       (use - to read the EXR from stdin or write the TIFF to stdout)\n");
+    fprintf(stderr, "       %s [options] --batch input.exr output.tif [input.exr output.tif ...]\n", argv0);
+    fprintf(stderr, "       %s [options] --list jobs.txt\n", argv0);
+    fprintf(stderr, "       %s [options] --frames 1001-1240 input.####.exr output.####.tif\n", argv0);
+    fprintf(stderr, "       %s [options] --watch dir [--watch dir ...]\n", argv0);
+    fprintf(stderr, "       %s [options] --server socket\n", argv0);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --block-rows N      Decode N scanlines at a time (default %i)\n", ConvertOptions().block_rows);
+    fprintf(stderr, "  --rows-per-strip N  Write N rows per TIFF strip (default: strips of about 128 KB)\n");
+    fprintf(stderr, "  --crop X,Y,W,H      Only convert the WxH region at X,Y, in data window coordinates\n");
+    fprintf(stderr, "  --part P            Convert part P of a multi-part EXR, by name or index\n");
+    fprintf(stderr, "  --split-parts       Write each part (or each --part P1,P2,...) to its own TIFF.\n");
+    fprintf(stderr, "                      {part} in the output filename is replaced with the part name.\n");
+    fprintf(stderr, "  --split-layers      Write each layer (diffuse.R, diffuse.G, ...) to its own TIFF.\n");
+    fprintf(stderr, "                      {layer} in the output filename is replaced with the layer name.\n");
+    fprintf(stderr, "  --mip-level N       Convert mip level N of a tiled EXR, or X,Y for a rip level\n");
+    fprintf(stderr, "  --half              Write 16-bit float TIFFs, keeping 16-bit EXR data as it is\n");
+    fprintf(stderr, "  --bits N            Write 8 or 16-bit integer TIFFs, or 32-bit float (the default)\n");
+    fprintf(stderr, "  --transfer T        Encode integer output with linear, srgb or rec709 (default linear)\n");
+    fprintf(stderr, "  --gamma G           Encode integer output with a 1/G power curve\n");
+    fprintf(stderr, "  --tile WxH          Write a tiled TIFF with WxH tiles\n");
+    fprintf(stderr, "  --compression C     Use none, lzw, deflate, zstd or lerc compression (default lzw)\n");
+    fprintf(stderr, "  --level N           Deflate (1-9) or ZSTD (1-22) compression level\n");
+    fprintf(stderr, "  --preset P          Compress for fastest, balanced or smallest output\n");
+    fprintf(stderr, "                      Maya only reads lzw, which is what balanced uses\n");
+    fprintf(stderr, "  --predictor P       Use the none, horizontal or float TIFF predictor (default none)\n");
+    fprintf(stderr, "  --threads N         Decompress with N threads (default %i)\n", ConvertOptions().threads);
+    fprintf(stderr, "  --encode-threads N  Compress strips with N threads (default %i)\n", ConvertOptions().encode_threads);
+    fprintf(stderr, "  --stats             Print decode and encode timing\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Batch options:\n");
+    fprintf(stderr, "  --batch             Convert each pair of filenames\n");
+    fprintf(stderr, "  --list FILE         Convert the input and output filenames on each line of FILE\n");
+    fprintf(stderr, "  --jobs N            Convert N files at once (default %i)\n", max((int) thread::hardware_concurrency(), 1));
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Sequence options:\n");
+    fprintf(stderr, "  --frames RANGES     Convert these frames, eg. 1001-1240, 1001-1240x2 or 1,5,10-20.\n");
+    fprintf(stderr, "                      Filenames contain #### or %%04d where the frame number goes.\n");
+    fprintf(stderr, "  --exclude RANGES    Skip these frames\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Watch options:\n");
+    fprintf(stderr, "  --watch DIR         Convert EXRs as they're written to DIR, until killed\n");
+    fprintf(stderr, "  --output-dir DIR    Write watched files' TIFFs to DIR instead of alongside the input\n");
+    fprintf(stderr, "  --settle N          Convert files that aren't closed after N seconds without writes (default 10)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Server options:\n");
+    fprintf(stderr, "  --server PATH       Listen for conversions on a Unix domain socket, until killed\n");
+    fprintf(stderr, "  --client PATH       Send this conversion to the server at PATH\n");
+    fprintf(stderr, "If EXRTOTIFF_SERVER is set to a socket path, single conversions are sent to the\n");
+    fprintf(stderr, "server there if it's running, and converted locally otherwise.\n");
+}
+
+// Parse a --compression value.  Return false if it isn't one we know.
+static bool parse_compression(const string &value, int &compression)
+{
+    if(value == "none")
+        compression = COMPRESSION_NONE;
+    else if(value == "lzw")
+        compression = COMPRESSION_LZW;
+    else if(value == "deflate")
+        compression = COMPRESSION_ADOBE_DEFLATE;
+#ifdef COMPRESSION_ZSTD
+    else if(value == "zstd")
+        compression = COMPRESSION_ZSTD;
+#endif
+#ifdef COMPRESSION_LERC
+    else if(value == "lerc")
+        compression = COMPRESSION_LERC;
+#endif
+    else
+        return false;
+    return true;
+}
+
+// Apply a --preset.  Return false if it isn't one we know.  ZSTD is used if libtiff has
+// it, since it's faster than Deflate at the same ratio, otherwise Deflate.
+static bool apply_preset(const string &value, ConvertOptions &options)
+{
+    int zstd = 0;
+#ifdef COMPRESSION_ZSTD
+    if(TIFFIsCODECConfigured(COMPRESSION_ZSTD))
+        zstd = COMPRESSION_ZSTD;
+#endif
 
-    // Interleave the channels and output the data.
-    vector<float> row(width*output_channels.size(), 1);
-    for (int y = 0; y < height; y++)
+    if(value == "fastest")
     {
-        for(int x = 0; x < width; ++x)
+        options.compression = zstd? zstd: COMPRESSION_ADOBE_DEFLATE;
+        options.level = 1;
+    }
+    else if(value == "balanced")
+    {
+        // LZW is the default, and is what Maya reads.
+        options.compression = COMPRESSION_LZW;
+        options.level = 0;
+    }
+    else if(value == "smallest")
+    {
+        options.compression = zstd? zstd: COMPRESSION_ADOBE_DEFLATE;
+        options.level = zstd? 19: 9;
+    }
+    else
+        return false;
+    return true;
+}
+
+// Parse a positive integer option value.  Return false if it isn't one.
+static bool parse_int(const char *value, int &result)
+{
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if(end == value || *end != 0 || parsed <= 0 || parsed > 0x7FFFFFFF)
+        return false;
+    result = (int) parsed;
+    return true;
+}
+
+// Convert one file, where "-" reads the EXR from stdin or writes the TIFF to stdout.
+//
+// EXR and TIFF both need random access, so neither can be streamed through a pipe
+// directly.  Input from stdin is read into memory and decoded from there, and output
+// to stdout is written to memory and copied to stdout when it's complete.
+static void convert_single(const string &input_filename, const string &output_filename, const ConvertOptions &options)
+{
+    if(input_filename != "-" && output_filename != "-")
+    {
+        convert(input_filename, output_filename, options);
+        return;
+    }
+
+    vector<char> input_data;
+    if(input_filename == "-")
+    {
+        char buf[64*1024];
+        size_t bytes;
+        while((bytes = fread(buf, 1, sizeof(buf), stdin)) > 0)
+            input_data.insert(input_data.end(), buf, buf + bytes);
+        if(ferror(stdin))
+            throw runtime_error("Error reading stdin");
+    }
+
+    if(output_filename != "-")
+    {
+        MemoryIStream input(input_data.data(), input_data.size(), "stdin");
+        convert(input, output_filename, options);
+        return;
+    }
+
+    MemoryTiffSink output;
+    if(input_filename == "-")
+    {
+        MemoryIStream input(input_data.data(), input_data.size(), "stdin");
+        convert(input, output, options);
+    }
+    else
+        convert(input_filename, output, options);
+
+    if(fwrite(output.data.data(), 1, output.data.size(), stdout) != output.data.size() || fflush(stdout) != 0)
+        throw runtime_error("Error writing stdout");
+}
+
+// Everything parsed from the command line.
+struct CommandLine
+{
+    ConvertOptions options;
+    vector<string> filenames;
+    int jobs = max((int) thread::hardware_concurrency(), 1);
+
+    // Batch mode.
+    bool batch = false;
+    string list_filename;
+
+    // Sequence mode.
+    set<int> frames, excluded_frames;
+
+    // Watch mode.
+    vector<string> watch_dirs;
+    string output_dir;
+    int settle_seconds = 10;
+
+    // Server mode.
+    string server_path;
+
+    // Return true if this is a plain conversion of one file.
+    bool single_file() const
+    {
+        return !batch && list_filename.empty() && frames.empty() && watch_dirs.empty() && server_path.empty();
+    }
+};
+
+// Parse command line arguments, not including argv[0].  On error, return false and set
+// error, or leave it empty if usage should be shown.
+static bool parse_command_line(const vector<string> &args, CommandLine &cmd, string &error)
+{
+    ConvertOptions &options = cmd.options;
+    options.warning = [](const string &message) { fprintf(stderr, "%s\n", message.c_str()); };
+
+    // --half and --bits both set the output type, so they can't be combined.
+    bool half = false, bits = false;
+    for(size_t i = 0; i < args.size(); ++i)
+    {
+        const string &arg = args[i];
+        bool has_value = i + 1 < args.size();
+        if((arg == "--block-rows" || arg == "--rows-per-strip" || arg == "--threads" ||
+            arg == "--encode-threads" || arg == "--level" || arg == "--jobs" || arg == "--settle") && has_value)
+        {
+            int &value =
+                arg == "--block-rows"? options.block_rows:
+                arg == "--rows-per-strip"? options.rows_per_strip:
+                arg == "--threads"? options.threads:
+                arg == "--level"? options.level:
+                arg == "--jobs"? cmd.jobs:
+                arg == "--settle"? cmd.settle_seconds:
+                options.encode_threads;
+            if(!parse_int(args[++i].c_str(), value))
+            {
+                error = "Invalid value for " + arg + ": " + args[i];
+                return false;
+            }
+        }
+        else if(arg == "--tile" && has_value)
+        {
+            // TIFF requires tile sizes to be multiples of 16.
+            const string &value = args[++i];
+            if(sscanf(value.c_str(), "%dx%d", &options.tile_width, &options.tile_height) != 2 ||
+                options.tile_width <= 0 || options.tile_height <= 0 ||
+                options.tile_width % 16 != 0 || options.tile_height % 16 != 0)
+            {
+                error = "Invalid value for " + arg + ": " + value + " (tile sizes must be multiples of 16)";
+                return false;
+            }
+        }
+        else if(arg == "--crop" && has_value)
+        {
+            const string &value = args[++i];
+            char extra;
+            if(sscanf(value.c_str(), "%d,%d,%d,%d%c", &options.crop_x, &options.crop_y, &options.crop_width, &options.crop_height, &extra) != 4 ||
+                options.crop_width <= 0 || options.crop_height <= 0)
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--part" && has_value)
         {
-            for(int c = 0; c < (int) output_channels.size(); ++c)
+            const string &value = args[++i];
+            options.parts.clear();
+            size_t start = 0;
+            while(true)
             {
-                float value = (*output_channels[c])[y*width + x];
+                size_t comma = value.find(',', start);
+                options.parts.push_back(value.substr(start, comma == string::npos? string::npos: comma - start));
+                if(comma == string::npos)
+                    break;
+                start = comma + 1;
+            }
+        }
+        else if(arg == "--split-parts")
+            options.split_parts = true;
+        else if(arg == "--split-layers")
+            options.split_layers = true;
+        else if(arg == "--half")
+        {
+            options.output_type = OUTPUT_FLOAT16;
+            half = true;
+        }
+        else if(arg == "--bits" && has_value)
+        {
+            const string &value = args[++i];
+            bits = true;
+            if(value == "8")
+                options.output_type = OUTPUT_UINT8;
+            else if(value == "16")
+                options.output_type = OUTPUT_UINT16;
+            else if(value == "32")
+                options.output_type = OUTPUT_FLOAT32;
+            else
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--transfer" && has_value)
+        {
+            const string &value = args[++i];
+            if(value == "linear")
+                options.transfer = TRANSFER_LINEAR;
+            else if(value == "srgb")
+                options.transfer = TRANSFER_SRGB;
+            else if(value == "rec709")
+                options.transfer = TRANSFER_REC709;
+            else
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--gamma" && has_value)
+        {
+            const string &value = args[++i];
+            char *end;
+            options.gamma = strtof(value.c_str(), &end);
+            options.transfer = TRANSFER_GAMMA;
+            if(value.empty() || *end != 0 || !(options.gamma > 0))
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--mip-level" && has_value)
+        {
+            // N selects a mip level, and X,Y a rip level.
+            const string &value = args[++i];
+            char extra;
+            int fields = sscanf(value.c_str(), "%d,%d%c", &options.mip_level_x, &options.mip_level_y, &extra);
+            if(fields == 1)
+                options.mip_level_y = options.mip_level_x;
+            if((fields != 1 && fields != 2) || options.mip_level_x < 0 || options.mip_level_y < 0)
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if((arg == "--compression" || arg == "--preset") && has_value)
+        {
+            const string &value = args[++i];
+            bool valid = arg == "--compression"? parse_compression(value, options.compression): apply_preset(value, options);
+            if(!valid)
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--predictor" && has_value)
+        {
+            const string &value = args[++i];
+            if(value == "none")
+                options.predictor = PREDICTOR_NONE;
+            else if(value == "horizontal")
+                options.predictor = PREDICTOR_HORIZONTAL;
+            else if(value == "float")
+                options.predictor = PREDICTOR_FLOATINGPOINT;
+            else
+            {
+                error = "Invalid value for " + arg + ": " + value;
+                return false;
+            }
+        }
+        else if(arg == "--stats")
+            options.stats = true;
+        else if(arg == "--batch")
+            cmd.batch = true;
+        else if(arg == "--list" && has_value)
+            cmd.list_filename = args[++i];
+        else if(arg == "--watch" && has_value)
+            cmd.watch_dirs.push_back(args[++i]);
+        else if(arg == "--output-dir" && has_value)
+            cmd.output_dir = args[++i];
+        else if(arg == "--server" && has_value)
+            cmd.server_path = args[++i];
+        else if((arg == "--frames" || arg == "--exclude") && has_value)
+        {
+            if(!parse_frame_ranges(args[++i], arg == "--frames"? cmd.frames: cmd.excluded_frames))
+            {
+                error = "Invalid value for " + arg + ": " + args[i];
+                return false;
+            }
+        }
+        else if(arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+            return false;
+        else
+            cmd.filenames.push_back(arg);
+    }
 
-                // Normals in OpenEXR are [-1,+1] floating-point values.  However, even when the data
-                // is floating-point, Maya still expects [0,1] data for other file formats.
-                if(convert_normals)
-                    value = (value / 2) + 0.5;
-                row[x*channels+c] = value;
+    if(half && bits)
+    {
+        error = "--half and --bits can't be used together.";
+        return false;
+    }
+
+    if(options.transfer != TRANSFER_LINEAR && options.output_type != OUTPUT_UINT8 && options.output_type != OUTPUT_UINT16)
+    {
+        error = "--transfer and --gamma need --bits 8 or 16.";
+        return false;
+    }
+
+    if(options.parts.size() > 1 && !options.split_parts)
+    {
+        error = "Use --split-parts to convert more than one part.";
+        return false;
+    }
+    return true;
+}
+
+// Read NUL-terminated strings from fd until an empty one.  Return false if the connection
+// is closed or the read times out first.
+static bool read_strings(int fd, vector<string> &result)
+{
+    string current;
+    char buf[4096];
+    while(true)
+    {
+        ssize_t bytes = read(fd, buf, sizeof(buf));
+        if(bytes == -1 && errno == EINTR)
+            continue;
+        if(bytes <= 0)
+            return false;
+
+        for(ssize_t i = 0; i < bytes; ++i)
+        {
+            if(buf[i] != 0)
+            {
+                current += buf[i];
+                continue;
             }
+
+            if(current.empty())
+                return true;
+            result.push_back(current);
+            current.clear();
+        }
+    }
+}
+
+static bool write_all(int fd, const string &data)
+{
+    size_t pos = 0;
+    while(pos < data.size())
+    {
+        ssize_t bytes = write(fd, data.data() + pos, data.size() - pos);
+        if(bytes == -1 && errno == EINTR)
+            continue;
+        if(bytes <= 0)
+            return false;
+        pos += bytes;
+    }
+    return true;
+}
+
+static void make_unix_address(const string &path, sockaddr_un &addr)
+{
+    if(path.size() >= sizeof(addr.sun_path))
+        throw runtime_error("Socket path is too long: " + path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+}
+
+// Return a new Unix domain stream socket, or -1 on error.  SOCK_CLOEXEC and accept4 are
+// Linux-only, so close-on-exec is set separately.
+static int unix_socket()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd != -1)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Return true if a server is accepting connections at addr.
+static bool server_running(const sockaddr_un &addr)
+{
+    int fd = unix_socket();
+    if(fd == -1)
+        return false;
+    bool result = connect(fd, (const sockaddr *) &addr, sizeof(addr)) == 0 || errno != ECONNREFUSED;
+    close(fd);
+    return result;
+}
+
+// Handle one request from a client.  A request is the client's working directory, then
+// its command line arguments, each terminated by a NUL, with an empty string at the end.
+// The response is any warnings and --stats output for the client to print, then a last
+// line of "ok", or "error: " followed by a message.
+static void handle_request(int fd)
+{
+    vector<string> args;
+    if(!read_strings(fd, args) || args.empty())
+        return;
+
+    string cwd = args[0];
+    args.erase(args.begin());
+
+    // Collect output for the client instead of printing it on the server's stderr.  Parts
+    // can be converted in parallel, so this can be called from more than one thread.
+    mutex output_lock;
+    string output;
+    auto add_output = [&](const string &text) {
+        lock_guard<mutex> guard(output_lock);
+        output += text;
+    };
+
+    string response = "ok\n";
+    try {
+        CommandLine cmd;
+        string error;
+        if(!parse_command_line(args, cmd, error))
+            throw runtime_error(error.empty()? "Invalid arguments": error);
+        if(!cmd.single_file() || cmd.filenames.size() != 2)
+            throw runtime_error("The server only converts one input file to one output file at a time");
+
+        // The server runs for a long time, and a client may ask for a file that's still
+        // being rewritten.  Read it without mapping it, so a truncated file is an error for
+        // this request and not a SIGBUS for the whole server.
+        cmd.options.memory_map = false;
+
+        cmd.options.warning = [&](const string &message) { add_output(message + "\n"); };
+        cmd.options.stats_output = add_output;
+
+        // Filenames are relative to the client's directory, not ours.
+        for(string &filename: cmd.filenames)
+        {
+            if(!filename.empty() && filename[0] != '/')
+                filename = cwd + "/" + filename;
         }
-        if(TIFFWriteScanline(tif, &row[0], y, 0) < 0)
+
+        convert(cmd.filenames[0], cmd.filenames[1], cmd.options);
+    } catch(exception &e) {
+        response = string("error: ") + e.what() + "\n";
+    }
+
+    write_all(fd, output + response);
+}
+
+// Listen for conversion requests on a Unix domain socket, until we're killed.  Requests
+// run on a job pool that stays running, along with the decode and encode pools, so
+// nothing is started up per request.
+static int serve(const string &socket_path, int job_threads)
+{
+    // Don't die if a client disconnects before we respond.
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    make_unix_address(socket_path, addr);
+
+    // Remove a stale socket left behind by a previous server.  If a server is still
+    // listening there, leave it alone; bind will fail and we'll report it.
+    struct stat st;
+    if(stat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && !server_running(addr))
+        unlink(socket_path.c_str());
+
+    int fd = unix_socket();
+    if(fd == -1)
+    {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if(bind(fd, (sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 64) == -1)
+    {
+        fprintf(stderr, "Couldn't listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    ThreadPool pool(job_threads);
+    while(true)
+    {
+        int client = accept(fd, NULL, NULL);
+        if(client == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "accept: %s\n", strerror(errno));
             break;
+        }
+        fcntl(client, F_SETFD, FD_CLOEXEC);
+
+        // Don't let a client that connects and never sends a request tie up a job thread.
+        timeval timeout = { 30, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        pool.run([client] {
+            handle_request(client);
+            close(client);
+        });
+    }
+
+    close(fd);
+    return 1;
+}
+
+// Send a command line to a server and wait for the result.  If we can't connect, set
+// connected to false and return 1.
+static int run_client(const string &socket_path, const vector<string> &args, bool &connected)
+{
+    connected = false;
+    sockaddr_un addr;
+    make_unix_address(socket_path, addr);
+
+    int fd = unix_socket();
+    if(fd == -1)
+        return 1;
+    if(connect(fd, (sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return 1;
+    }
+    connected = true;
+
+    char cwd[PATH_MAX];
+    if(getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        close(fd);
+        throw runtime_error("getcwd failed");
+    }
+
+    string request = string(cwd) + '\0';
+    for(const string &arg: args)
+        request += arg + '\0';
+    request += '\0';
+
+    string response;
+    char buf[4096];
+    ssize_t bytes;
+    if(write_all(fd, request))
+    {
+        while((bytes = read(fd, buf, sizeof(buf))) > 0 || (bytes == -1 && errno == EINTR))
+            response.append(buf, max(bytes, (ssize_t) 0));
+    }
+    close(fd);
+
+    // Print the warnings and stats that come before the last line, which is the result.
+    size_t last_line = 0;
+    if(response.size() >= 2)
+    {
+        size_t newline = response.rfind('\n', response.size() - 2);
+        if(newline != response.npos)
+            last_line = newline + 1;
     }
+    fprintf(stderr, "%s", response.substr(0, last_line).c_str());
+    string result = response.substr(last_line);
+
+    if(result == "ok\n")
+        return 0;
 
-    TIFFClose(tif);
+    if(result.compare(0, 7, "error: ") == 0)
+        fprintf(stderr, "%s", result.c_str() + 7);
+    else
+        fprintf(stderr, "The server at %s didn't respond\n", socket_path.c_str());
+    return 1;
 }
 
 int main(int argc, char *argv[])
 {
-    if(argc != 3)
+    // --client sends the rest of the command line to a server.  If EXRTOTIFF_SERVER is set,
+    // single conversions are sent to the server at that path if one is running, so scripts
+    // can use a server without changing how they run us.
+    vector<string> args;
+    string client_path;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(string(argv[i]) == "--client" && i + 1 < argc)
+            client_path = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+
+    CommandLine cmd;
+    string error;
+    if(!parse_command_line(args, cmd, error))
+    {
+        if(error.empty())
+            usage(argv[0]);
+        else
+            fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    const char *server_env = getenv("EXRTOTIFF_SERVER");
+    // Pipes can't be sent to a server, so conversions from stdin or to stdout are always
+    // local.
+    bool uses_pipes = find(cmd.filenames.begin(), cmd.filenames.end(), "-") != cmd.filenames.end();
+    if(cmd.single_file() && !uses_pipes && (!client_path.empty() || (server_env != NULL && *server_env)))
+    {
+        bool connected;
+        string path = !client_path.empty()? client_path: server_env;
+        try {
+            int result = run_client(path, args, connected);
+            if(connected)
+                return result;
+        } catch(exception &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+
+        // If --client was given explicitly, it's an error if the server isn't running.
+        // Otherwise, convert locally.
+        if(!client_path.empty())
+        {
+            fprintf(stderr, "Couldn't connect to %s: %s\n", path.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    ConvertOptions &options = cmd.options;
+    vector<string> &filenames = cmd.filenames;
+    set_global_thread_count(options.threads);
+
+    if(!cmd.server_path.empty())
+    {
+        if(!filenames.empty())
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        try {
+            return serve(cmd.server_path, cmd.jobs);
+        } catch(exception &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+    if(!cmd.watch_dirs.empty())
+    {
+        if(!filenames.empty())
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+#ifdef __linux__
+        // Watched files may be rewritten while we read them, so don't map them.  See
+        // ConvertOptions::memory_map.
+        options.memory_map = false;
+        return watch(cmd.watch_dirs, cmd.output_dir, options, cmd.jobs, cmd.settle_seconds);
+#else
+        fprintf(stderr, "--watch is only supported on Linux.\n");
+        return 1;
+#endif
+    }
+
+    if(!cmd.frames.empty())
     {
-        printf("Usage: %s input.exr output.exr\n", argv[0]);
+        if(filenames.size() != 2 || !is_frame_pattern(filenames[0]) || !is_frame_pattern(filenames[1]))
+        {
+            fprintf(stderr, "--frames needs an input and output filename containing #### or %%04d\n");
+            return 1;
+        }
+
+        // Missing frames are reported in the summary, and don't stop the rest of the range
+        // from being converted.
+        vector<Job> job_list;
+        for(int frame: cmd.frames)
+        {
+            if(cmd.excluded_frames.count(frame))
+                continue;
+
+            Job job;
+            job.input_filename = expand_frame_pattern(filenames[0], frame);
+            job.output_filename = expand_frame_pattern(filenames[1], frame);
+            job.missing = !file_exists(job.input_filename);
+            job_list.push_back(job);
+        }
+
+        run_jobs(job_list, options, cmd.jobs);
+        return print_summary(job_list) == 0? 0: 1;
+    }
+
+    if(cmd.batch || !cmd.list_filename.empty())
+    {
+        if(filenames.size() % 2 != 0 || (filenames.empty() && cmd.list_filename.empty()))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        vector<Job> job_list;
+        for(size_t i = 0; i < filenames.size(); i += 2)
+        {
+            Job job;
+            job.input_filename = filenames[i];
+            job.output_filename = filenames[i+1];
+            job_list.push_back(job);
+        }
+
+        if(!cmd.list_filename.empty() && !read_job_list(cmd.list_filename, job_list))
+            return 1;
+
+        run_jobs(job_list, options, cmd.jobs);
+        return print_summary(job_list) == 0? 0: 1;
+    }
+
+    if(filenames.size() != 2)
+    {
+        usage(argv[0]);
         return 1;
     }
 
-    string input_filename = argv[1];
-    string output_filename = argv[2];
+    string input_filename = filenames[0];
+    string output_filename = filenames[1];
     try {
-        convert(input_filename, output_filename);
+        convert_single(input_filename, output_filename, options);
     } catch(exception &e) {
         fprintf(stderr, "%s\n", e.what());
-        return 0;
+        return 1;
     }
     return 0;
 }
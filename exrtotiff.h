@@ -0,0 +1,205 @@
+// This file is in the public domain.
+#ifndef EXRTOTIFF_H
+#define EXRTOTIFF_H
+
+#include <ImfIO.h>
+#include "tiffio.h"
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Convert OpenEXR files to TIFF.
+//
+// Errors are thrown as exceptions derived from std::exception.  libtiff also reports the
+// details of its errors through its error handler, which prints them to stderr unless
+// it's been replaced with TIFFSetErrorHandler.
+namespace exrtotiff
+{
+
+// The sample type of the TIFF we write.
+enum OutputType
+{
+    // 32-bit float.  HALF EXR channels are widened.
+    OUTPUT_FLOAT32,
+
+    // 16-bit float.  HALF channels are kept as they are from decoding to output, and
+    // 32-bit channels are narrowed.
+    OUTPUT_FLOAT16,
+
+    // 8 or 16-bit unsigned integers.  Values are clamped to [0,1], encoded with the
+    // transfer curve, then scaled and rounded.
+    OUTPUT_UINT8,
+    OUTPUT_UINT16,
+};
+
+// The transfer curve used to encode color channels for integer output.  Alpha is always
+// left linear.
+enum TransferCurve
+{
+    TRANSFER_LINEAR,
+    TRANSFER_SRGB,
+    TRANSFER_REC709,
+
+    // A plain power curve with ConvertOptions::gamma.
+    TRANSFER_GAMMA,
+};
+
+struct ConvertOptions
+{
+    // The number of scanlines to decode at a time.  Only this many rows of each channel
+    // are held in memory, so memory use doesn't depend on the image height.
+    int block_rows = 64;
+
+    // The number of rows in each TIFF strip, or 0 to choose automatically.
+    int rows_per_strip = 0;
+
+    // If crop_width and crop_height are nonzero, only convert this region of the image,
+    // in the same pixel coordinates as the EXR's data window.  Only the part of the region
+    // inside the data window is output.
+    int crop_x = 0, crop_y = 0, crop_width = 0, crop_height = 0;
+
+    // For multi-part EXRs, the parts to convert, by name or index.  Normally one part is
+    // converted, the first unless one is listed here.  If split_parts is set, each part
+    // is written to its own TIFF, every part unless some are listed.  The output filename
+    // can contain {part}, which is replaced with the part's name; otherwise the name is
+    // added before the extension.  Splitting parts needs an output filename.
+    std::vector<std::string> parts;
+    bool split_parts = false;
+
+    // If set, write each layer to its own TIFF, grouping channels by the prefix before the
+    // last period ("diffuse.R" is in the "diffuse" layer, and channels without a prefix are
+    // in "rgba").  Every layer comes from the same decode.  The output filename can contain
+    // {layer}, like {part}.  Splitting layers needs an output filename.
+    bool split_layers = false;
+
+    // For tiled EXRs with mip or rip maps, the level to convert.  For mipmaps, both are
+    // the same.  The crop region is in the level's coordinates.
+    int mip_level_x = 0, mip_level_y = 0;
+
+    // If nonzero, write a tiled TIFF with tiles of this size instead of strips.
+    int tile_width = 0, tile_height = 0;
+
+    // The TIFF compression.  Maya doesn't support COMPRESSION_DEFLATE, so we use LZW by
+    // default.
+    int compression = COMPRESSION_LZW;
+
+    // The Deflate or ZSTD compression level, or 0 to use the codec's default.
+    int level = 0;
+
+    // The sample type to write.
+    OutputType output_type = OUTPUT_FLOAT32;
+
+    // For integer output, how color values are encoded, and the gamma for TRANSFER_GAMMA.
+    TransferCurve transfer = TRANSFER_LINEAR;
+    float gamma = 2.2f;
+
+    // The TIFF predictor: PREDICTOR_NONE, PREDICTOR_HORIZONTAL or PREDICTOR_FLOATINGPOINT.
+    // The floating-point predictor only works with float output.
+    int predictor = PREDICTOR_NONE;
+
+    // How many threads to decompress with.  1 decompresses on the calling thread.  This
+    // only sets how many chunks each file reads at once; the work runs on OpenEXR's global
+    // thread pool, which has no threads until set_global_thread_count is called, and
+    // convert() never resizes it, since other code in the process may share it.  Library
+    // callers that want parallel decoding should call set_global_thread_count once first.
+    int threads = std::max((int) std::thread::hardware_concurrency(), 1);
+
+    // The number of threads used to compress TIFF strips.  1 compresses on the calling
+    // thread with libtiff's normal write path.
+    int encode_threads = std::max((int) std::thread::hardware_concurrency(), 1);
+
+    // If true, report timing for decoding and encoding.  The report is passed to
+    // stats_output if it's set, and printed to stderr otherwise.  Like warning, this may
+    // be called from more than one thread at once.
+    bool stats = false;
+    std::function<void(const std::string &text)> stats_output;
+
+    // If true, input files are read through a memory mapping, otherwise with pread.  If
+    // a mapped file is truncated while we're reading it, the read raises SIGBUS and kills
+    // the process, so long-running processes that may read files while something else
+    // rewrites them should turn this off.
+    bool memory_map = true;
+
+    // Called with a message for problems that don't stop the conversion, like channels
+    // that can't be output.  The library never prints these itself.  This may be called
+    // from more than one thread at once when converting parts in parallel.
+    std::function<void(const std::string &message)> warning;
+};
+
+// Where TIFF output is written.  libtiff seeks back to earlier parts of the file while
+// writing it, so this is a random-access file and not just a stream.
+class TiffSink
+{
+public:
+    virtual ~TiffSink() { }
+
+    // Read or write size bytes at the current position, returning the number of bytes
+    // read or written.
+    virtual size_t read(void *data, size_t size) = 0;
+    virtual size_t write(const void *data, size_t size) = 0;
+
+    // Seek like lseek, returning the new position.
+    virtual uint64_t seek(int64_t offset, int whence) = 0;
+
+    virtual uint64_t size() = 0;
+};
+
+// A TiffSink that writes to memory.
+class MemoryTiffSink: public TiffSink
+{
+public:
+    std::vector<char> data;
+
+    size_t read(void *buf, size_t size);
+    size_t write(const void *buf, size_t size);
+    uint64_t seek(int64_t offset, int whence);
+    uint64_t size() { return data.size(); }
+
+private:
+    size_t pos = 0;
+};
+
+// An Imf::IStream that reads an EXR from memory.  The data isn't copied, so it needs
+// to stay valid while the stream is used.
+class MemoryIStream: public Imf::IStream
+{
+public:
+    MemoryIStream(const char *data, size_t size, const char *name = "memory");
+
+    bool isMemoryMapped() const { return true; }
+    bool read(char c[], int n);
+    char *readMemoryMapped(int n);
+    Imf::Int64 tellg() { return pos; }
+    void seekg(Imf::Int64 new_pos) { pos = new_pos; }
+
+private:
+    const char *data;
+    size_t data_size;
+    size_t pos = 0;
+};
+
+// Set the number of threads in OpenEXR's global thread pool, which decompression uses and
+// which is shared by all conversions and anything else in the process that uses OpenEXR.
+// Call this before converting, normally with ConvertOptions::threads.  Without it the
+// pool is empty and every file decompresses on the calling thread.
+void set_global_thread_count(int threads);
+
+// Convert an EXR file to a TIFF file.
+void convert(const std::string &input_filename, const std::string &output_filename, const ConvertOptions &options);
+
+// Convert an EXR read from a stream to a TIFF written to a sink.
+void convert(Imf::IStream &input, TiffSink &output, const ConvertOptions &options);
+
+// Convert between a file and a stream or sink.
+void convert(Imf::IStream &input, const std::string &output_filename, const ConvertOptions &options);
+void convert(const std::string &input_filename, TiffSink &output, const ConvertOptions &options);
+
+// Convert an EXR in memory to a TIFF in memory.
+std::vector<char> convert(const char *data, size_t size, const ConvertOptions &options);
+
+}
+
+#endif
@@ -0,0 +1,593 @@
+// This file is in the public domain.
+#include "interleave.h"
+#include <half.h>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <stddef.h>
+#include <tuple>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EXRTOTIFF_X86
+#include <immintrin.h>
+#endif
+
+namespace exrtotiff
+{
+
+using namespace std;
+
+// Normals in OpenEXR are [-1,+1] floating-point values.  However, even when the data
+// is floating-point, Maya still expects [0,1] data for other file formats.  The vector
+// versions multiply by 0.5 instead of dividing by 2, which rounds the same.
+static inline float remap(float v)
+{
+    return (v / 2) + 0.5f;
+}
+
+// Encode a linear [0,1] value with a transfer curve.
+static float encode_transfer(float v, TransferCurve curve, float gamma)
+{
+    switch(curve)
+    {
+    case TRANSFER_LINEAR:
+        return v;
+    case TRANSFER_SRGB:
+        return v <= 0.0031308f? v * 12.92f: 1.055f * powf(v, 1 / 2.4f) - 0.055f;
+    case TRANSFER_REC709:
+        return v < 0.018f? v * 4.5f: 1.099f * powf(v, 0.45f) - 0.099f;
+    case TRANSFER_GAMMA:
+        return powf(v, 1 / gamma);
+    }
+    return v;
+}
+
+uint16_t Quantizer::quantize(float v, bool alpha) const
+{
+    // This is written so NaNs fail the first test and become 0.
+    if(!(v > 0))
+        return 0;
+    if(v >= 1)
+        return (1 << bits) - 1;
+
+    if(!alpha)
+        v = encode_transfer(v, curve, gamma);
+    return uint16_t(v * ((1 << bits) - 1) + 0.5f);
+}
+
+const uint16_t *half_quantize_table(const Quantizer &quantizer, bool normals, bool alpha)
+{
+    // Alpha has no curve, so every alpha table for the same size is the same.
+    auto key = make_tuple(quantizer.bits, alpha? TRANSFER_LINEAR: quantizer.curve,
+        !alpha && quantizer.curve == TRANSFER_GAMMA? quantizer.gamma: 0.0f, normals, alpha);
+
+    static mutex lock;
+    static map<decltype(key), vector<uint16_t>> tables;
+    lock_guard<mutex> guard(lock);
+    vector<uint16_t> &table = tables[key];
+    if(table.empty())
+    {
+        table.resize(65536);
+        for(int bits = 0; bits < 65536; ++bits)
+        {
+            half h;
+            h.setBits(bits);
+            float v = h;
+            table[bits] = quantizer.quantize(normals? remap(v): v, alpha);
+        }
+    }
+    return table.data();
+}
+
+// Convert between samples and floats.  half converts through OpenEXR's table.
+static inline float to_float(float v) { return v; }
+static inline float to_float(half v) { return v; }
+
+template<typename Sample> static inline Sample from_float(float v);
+template<> inline float from_float<float>(float v) { return v; }
+template<> inline half from_float<half>(float v) { return half(v); }
+
+// Convert an input sample to an output sample.  normal is set for channels that are
+// remapped as normals, and alpha for the alpha channel.  Samples that are already the
+// output type are copied, so 16-bit data passes through unchanged.
+template<typename In, typename Out>
+struct SampleConverter
+{
+    static inline Out convert(In v, bool normal, bool, const RowParams &)
+    {
+        float f = to_float(v);
+        return from_float<Out>(normal? remap(f): f);
+    }
+};
+
+template<typename Sample>
+struct SampleConverter<Sample, Sample>
+{
+    static inline Sample convert(Sample v, bool normal, bool, const RowParams &)
+    {
+        return normal? from_float<Sample>(remap(to_float(v))): v;
+    }
+};
+
+// Integer output.  HALF input is a lookup in a table that already has normals remapped
+// and the transfer curve applied.  FLOAT input is quantized directly.
+template<typename Out>
+struct IntegerConverter
+{
+    static inline Out convert(half v, bool, bool alpha, const RowParams &params)
+    {
+        return (alpha? params.alpha_table: params.color_table)[v.bits()];
+    }
+
+    static inline Out convert(float v, bool normal, bool alpha, const RowParams &params)
+    {
+        return params.quantizer->quantize(normal? remap(v): v, alpha);
+    }
+};
+
+template<> struct SampleConverter<half, uint8_t>: IntegerConverter<uint8_t> { };
+template<> struct SampleConverter<half, uint16_t>: IntegerConverter<uint16_t> { };
+template<> struct SampleConverter<float, uint8_t>: IntegerConverter<uint8_t> { };
+template<> struct SampleConverter<float, uint16_t>: IntegerConverter<uint16_t> { };
+
+// The plain C++ version.  With the layout known at compile time the inner loop is fully
+// unrolled.  The vector versions use this for the pixels left over at the end of the row.
+template<typename In, typename Out, int channels, bool has_alpha, bool normals>
+struct ScalarRow
+{
+    static void convert_range(const void *const *input, int start, int count, Out *out, const RowParams &params)
+    {
+        const In *const *planes = (const In *const *) input;
+        for(int x = start; x < count; ++x)
+        {
+            for(int c = 0; c < channels; ++c)
+            {
+                bool alpha = has_alpha && c == channels - 1;
+                out[x*channels + c] = SampleConverter<In, Out>::convert(planes[c][x], normals, alpha, params);
+            }
+        }
+    }
+
+    static void convert(const void *const *planes, int count, void *out, const RowParams &params)
+    {
+        convert_range(planes, 0, count, (Out *) out, params);
+    }
+};
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarFloatRow = ScalarRow<float, float, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarHalfRow = ScalarRow<half, half, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarFloatToHalfRow = ScalarRow<float, half, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarHalfToFloatRow = ScalarRow<half, float, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarHalfToUint8Row = ScalarRow<half, uint8_t, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarHalfToUint16Row = ScalarRow<half, uint16_t, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarFloatToUint8Row = ScalarRow<float, uint8_t, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using ScalarFloatToUint16Row = ScalarRow<float, uint16_t, channels, has_alpha, normals>;
+
+// Return Row<channels, has_alpha, normals>::convert.
+template<template<int, bool, bool> class Row, int channels>
+static RowConverter pick_layout(bool has_alpha, bool normals)
+{
+    if(has_alpha)
+        return normals? Row<channels, true, true>::convert: Row<channels, true, false>::convert;
+    return normals? Row<channels, false, true>::convert: Row<channels, false, false>::convert;
+}
+
+template<template<int, bool, bool> class Row>
+static RowConverter pick_layout(int channels, bool has_alpha, bool normals)
+{
+    switch(channels)
+    {
+    case 1: return pick_layout<Row, 1>(has_alpha, normals);
+    case 2: return pick_layout<Row, 2>(has_alpha, normals);
+    case 3: return pick_layout<Row, 3>(has_alpha, normals);
+    case 4: return pick_layout<Row, 4>(has_alpha, normals);
+    }
+    return NULL;
+}
+
+#ifdef EXRTOTIFF_X86
+
+// Fill idx with permute indices for output vector k when interleaving lanes pixels of
+// each channel.  Each entry is the pixel that lane takes, with bit 4 set for odd channels,
+// which selects the second source in a two-source permute.  channel_masks[c] gets the
+// lanes that come from channel c.
+static void interleave_indices(int channels, int lanes, int k, int *idx, unsigned *channel_masks)
+{
+    for(int c = 0; c < channels; ++c)
+        channel_masks[c] = 0;
+
+    for(int j = 0; j < lanes; ++j)
+    {
+        int n = k*lanes + j;
+        int c = n % channels;
+        idx[j] = (n / channels) | ((c & 1) << 4);
+        channel_masks[c] |= 1u << j;
+    }
+}
+
+// SSE2, 4 pixels at a time.
+template<int channels, bool has_alpha, bool normals>
+struct Sse2Row
+{
+    __attribute__((target("sse2")))
+    static inline __m128 load(const void *const *input, int c, int x)
+    {
+        const float *const *planes = (const float *const *) input;
+        __m128 v = _mm_loadu_ps(planes[c] + x);
+        if(normals)
+            v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f));
+        return v;
+    }
+
+    __attribute__((target("sse2")))
+    static void convert(const void *const *planes, int count, void *output, const RowParams &params)
+    {
+        float *out = (float *) output;
+        int x = 0;
+        if(channels == 1)
+        {
+            for(; x + 4 <= count; x += 4)
+                _mm_storeu_ps(out + x, load(planes, 0, x));
+        }
+        else if(channels == 2)
+        {
+            for(; x + 4 <= count; x += 4)
+            {
+                __m128 a = load(planes, 0, x);
+                __m128 b = load(planes, 1, x);
+                _mm_storeu_ps(out + x*2 + 0, _mm_unpacklo_ps(a, b));
+                _mm_storeu_ps(out + x*2 + 4, _mm_unpackhi_ps(a, b));
+            }
+        }
+        else if(channels == 3)
+        {
+            for(; x + 4 <= count; x += 4)
+            {
+                // Transpose to one pixel per vector with a junk fourth channel, then pack
+                // the four 3-float pixels into three vectors.
+                __m128 p0 = load(planes, 0, x);
+                __m128 p1 = load(planes, 1, x);
+                __m128 p2 = load(planes, 2, x);
+                __m128 p3 = _mm_setzero_ps();
+                _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+
+                __m128 t0 = _mm_shuffle_ps(p1, p0, _MM_SHUFFLE(2,2,0,0));
+                __m128 t2 = _mm_shuffle_ps(p2, p3, _MM_SHUFFLE(0,0,2,2));
+                _mm_storeu_ps(out + x*3 + 0, _mm_shuffle_ps(p0, t0, _MM_SHUFFLE(0,2,1,0)));
+                _mm_storeu_ps(out + x*3 + 4, _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1,0,2,1)));
+                _mm_storeu_ps(out + x*3 + 8, _mm_shuffle_ps(t2, p3, _MM_SHUFFLE(2,1,2,0)));
+            }
+        }
+        else if(channels == 4)
+        {
+            for(; x + 4 <= count; x += 4)
+            {
+                __m128 p0 = load(planes, 0, x);
+                __m128 p1 = load(planes, 1, x);
+                __m128 p2 = load(planes, 2, x);
+                __m128 p3 = load(planes, 3, x);
+                _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+                _mm_storeu_ps(out + x*4 + 0, p0);
+                _mm_storeu_ps(out + x*4 + 4, p1);
+                _mm_storeu_ps(out + x*4 + 8, p2);
+                _mm_storeu_ps(out + x*4 + 12, p3);
+            }
+        }
+
+        ScalarFloatRow<channels, has_alpha, normals>::convert_range(planes, x, count, out, params);
+    }
+};
+
+// Load 8 or 16 samples as floats.  HALF samples are converted with F16C or AVX-512
+// as they're loaded, so they're widened in the same pass that interleaves them.
+__attribute__((target("avx2,f16c")))
+static inline __m256 load8(const float *p)
+{
+    return _mm256_loadu_ps(p);
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256 load8(const half *p)
+{
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) p));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 load16(const float *p)
+{
+    return _mm512_loadu_ps(p);
+}
+
+// _mm512_cvtph_ps passes _mm512_undefined_ps to the builtin as the value for masked-off
+// lanes, and GCC 12 warns that it may be uninitialized once it's inlined here.  With every
+// lane enabled that value is never used, so pass zeros instead, which compiles to the same
+// unmasked instruction without the warning.
+__attribute__((target("avx512f")))
+static inline __m512 load16(const half *p)
+{
+    return _mm512_mask_cvtph_ps(_mm512_setzero_ps(), 0xFFFF, _mm256_loadu_si256((const __m256i *) p));
+}
+
+// AVX2, 8 pixels at a time.  Every AVX2 CPU also has F16C.
+template<typename In, int channels, bool has_alpha, bool normals>
+struct Avx2Row
+{
+    __attribute__((target("avx2,f16c")))
+    static inline __m256 load(const void *const *input, int c, int x)
+    {
+        const In *const *planes = (const In *const *) input;
+        __m256 v = load8(planes[c] + x);
+        if(normals)
+            v = _mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(0.5f)), _mm256_set1_ps(0.5f));
+        return v;
+    }
+
+    __attribute__((target("avx2,f16c")))
+    static void convert(const void *const *planes, int count, void *output, const RowParams &params)
+    {
+        float *out = (float *) output;
+        int x = 0;
+        if(channels == 1)
+        {
+            for(; x + 8 <= count; x += 8)
+                _mm256_storeu_ps(out + x, load(planes, 0, x));
+        }
+        else if(channels == 2)
+        {
+            for(; x + 8 <= count; x += 8)
+            {
+                __m256 a = load(planes, 0, x);
+                __m256 b = load(planes, 1, x);
+                __m256 lo = _mm256_unpacklo_ps(a, b);
+                __m256 hi = _mm256_unpackhi_ps(a, b);
+                _mm256_storeu_ps(out + x*2 + 0, _mm256_permute2f128_ps(lo, hi, 0x20));
+                _mm256_storeu_ps(out + x*2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+            }
+        }
+        else if(channels == 3)
+        {
+            // Each output vector gathers its lanes from all three channels with a cross-lane
+            // permute of each, then blends them together.
+            __m256i idx[3];
+            __m256 from_g[3], from_b[3];
+            for(int k = 0; k < 3; ++k)
+            {
+                int lanes[8];
+                unsigned masks[3];
+                interleave_indices(3, 8, k, lanes, masks);
+                idx[k] = _mm256_loadu_si256((const __m256i *) lanes);
+
+                int g[8], b[8];
+                for(int j = 0; j < 8; ++j)
+                {
+                    g[j] = (masks[1] >> j) & 1? -1: 0;
+                    b[j] = (masks[2] >> j) & 1? -1: 0;
+                }
+                from_g[k] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) g));
+                from_b[k] = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) b));
+            }
+
+            for(; x + 8 <= count; x += 8)
+            {
+                __m256 r = load(planes, 0, x);
+                __m256 g = load(planes, 1, x);
+                __m256 b = load(planes, 2, x);
+                for(int k = 0; k < 3; ++k)
+                {
+                    __m256 v = _mm256_permutevar8x32_ps(r, idx[k]);
+                    v = _mm256_blendv_ps(v, _mm256_permutevar8x32_ps(g, idx[k]), from_g[k]);
+                    v = _mm256_blendv_ps(v, _mm256_permutevar8x32_ps(b, idx[k]), from_b[k]);
+                    _mm256_storeu_ps(out + x*3 + k*8, v);
+                }
+            }
+        }
+        else if(channels == 4)
+        {
+            for(; x + 8 <= count; x += 8)
+            {
+                // Transpose within each 128-bit half, giving pixels 0 and 4, 1 and 5, and
+                // so on, then swap the halves into order.
+                __m256 r = load(planes, 0, x);
+                __m256 g = load(planes, 1, x);
+                __m256 b = load(planes, 2, x);
+                __m256 a = load(planes, 3, x);
+                __m256 rg_lo = _mm256_unpacklo_ps(r, g), rg_hi = _mm256_unpackhi_ps(r, g);
+                __m256 ba_lo = _mm256_unpacklo_ps(b, a), ba_hi = _mm256_unpackhi_ps(b, a);
+                __m256 p04 = _mm256_shuffle_ps(rg_lo, ba_lo, _MM_SHUFFLE(1,0,1,0));
+                __m256 p15 = _mm256_shuffle_ps(rg_lo, ba_lo, _MM_SHUFFLE(3,2,3,2));
+                __m256 p26 = _mm256_shuffle_ps(rg_hi, ba_hi, _MM_SHUFFLE(1,0,1,0));
+                __m256 p37 = _mm256_shuffle_ps(rg_hi, ba_hi, _MM_SHUFFLE(3,2,3,2));
+                _mm256_storeu_ps(out + x*4 + 0, _mm256_permute2f128_ps(p04, p15, 0x20));
+                _mm256_storeu_ps(out + x*4 + 8, _mm256_permute2f128_ps(p26, p37, 0x20));
+                _mm256_storeu_ps(out + x*4 + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+                _mm256_storeu_ps(out + x*4 + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+            }
+        }
+
+        ScalarRow<In, float, channels, has_alpha, normals>::convert_range(planes, x, count, out, params);
+    }
+};
+
+// AVX-512, 16 pixels at a time.  Two-source permutes pick from two channels at once, so
+// each output vector takes one or two permutes and at most one blend.
+template<typename In, int channels, bool has_alpha, bool normals>
+struct Avx512Row
+{
+    __attribute__((target("avx512f")))
+    static inline __m512 load(const void *const *input, int c, int x)
+    {
+        const In *const *planes = (const In *const *) input;
+        __m512 v = load16(planes[c] + x);
+        if(normals)
+            v = _mm512_add_ps(_mm512_mul_ps(v, _mm512_set1_ps(0.5f)), _mm512_set1_ps(0.5f));
+        return v;
+    }
+
+    __attribute__((target("avx512f")))
+    static void convert(const void *const *planes, int count, void *output, const RowParams &params)
+    {
+        float *out = (float *) output;
+        int x = 0;
+        if(channels == 1)
+        {
+            for(; x + 16 <= count; x += 16)
+                _mm512_storeu_ps(out + x, load(planes, 0, x));
+        }
+        else
+        {
+            __m512i idx[channels];
+            __mmask16 from_b[channels], from_ba[channels];
+            for(int k = 0; k < channels; ++k)
+            {
+                int lanes[16];
+                unsigned masks[4] = { 0, 0, 0, 0 };
+                interleave_indices(channels, 16, k, lanes, masks);
+                idx[k] = _mm512_loadu_si512(lanes);
+                from_b[k] = masks[2];
+                from_ba[k] = masks[2] | masks[3];
+            }
+
+            for(; x + 16 <= count; x += 16)
+            {
+                __m512 p[channels];
+                for(int c = 0; c < channels; ++c)
+                    p[c] = load(planes, c, x);
+
+                for(int k = 0; k < channels; ++k)
+                {
+                    __m512 v = _mm512_permutex2var_ps(p[0], idx[k], p[1]);
+                    if(channels == 3)
+                        v = _mm512_mask_permutexvar_ps(v, from_b[k], idx[k], p[2]);
+                    else if(channels == 4)
+                        v = _mm512_mask_blend_ps(from_ba[k], v, _mm512_permutex2var_ps(p[2], idx[k], p[3]));
+                    _mm512_storeu_ps(out + x*channels + k*16, v);
+                }
+            }
+        }
+
+        ScalarRow<In, float, channels, has_alpha, normals>::convert_range(planes, x, count, out, params);
+    }
+};
+
+template<int channels, bool has_alpha, bool normals>
+using Avx2FloatRow = Avx2Row<float, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using Avx2HalfRow = Avx2Row<half, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using Avx512FloatRow = Avx512Row<float, channels, has_alpha, normals>;
+
+template<int channels, bool has_alpha, bool normals>
+using Avx512HalfRow = Avx512Row<half, channels, has_alpha, normals>;
+
+#endif
+
+// The best instruction set the CPU supports.  The ones below it are supported too.
+static Isa choose_isa()
+{
+#ifdef EXRTOTIFF_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return ISA_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+        return ISA_AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return ISA_SSE2;
+#endif
+    return ISA_SCALAR;
+}
+
+static Isa isa()
+{
+    static Isa result = choose_isa();
+    return result;
+}
+
+RowConverter row_converter_scalar(int channels, bool has_alpha, bool normals, SampleType input, SampleType output)
+{
+    if(input == SAMPLE_FLOAT32 && output == SAMPLE_FLOAT32)
+        return pick_layout<ScalarFloatRow>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT16 && output == SAMPLE_FLOAT16)
+        return pick_layout<ScalarHalfRow>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT32 && output == SAMPLE_FLOAT16)
+        return pick_layout<ScalarFloatToHalfRow>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT16 && output == SAMPLE_FLOAT32)
+        return pick_layout<ScalarHalfToFloatRow>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT16 && output == SAMPLE_UINT8)
+        return pick_layout<ScalarHalfToUint8Row>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT16 && output == SAMPLE_UINT16)
+        return pick_layout<ScalarHalfToUint16Row>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT32 && output == SAMPLE_UINT8)
+        return pick_layout<ScalarFloatToUint8Row>(channels, has_alpha, normals);
+    if(input == SAMPLE_FLOAT32 && output == SAMPLE_UINT16)
+        return pick_layout<ScalarFloatToUint16Row>(channels, has_alpha, normals);
+    return NULL;
+}
+
+RowConverter row_converter_for_isa(Isa requested, int channels, bool has_alpha, bool normals, SampleType input, SampleType output)
+{
+    if(requested > isa())
+        return NULL;
+
+#ifdef EXRTOTIFF_X86
+    if(input == SAMPLE_FLOAT32 && output == SAMPLE_FLOAT32)
+    {
+        switch(requested)
+        {
+        case ISA_AVX512: return pick_layout<Avx512FloatRow>(channels, has_alpha, normals);
+        case ISA_AVX2: return pick_layout<Avx2FloatRow>(channels, has_alpha, normals);
+        case ISA_SSE2: return pick_layout<Sse2Row>(channels, has_alpha, normals);
+        case ISA_SCALAR: break;
+        }
+    }
+
+    // HALF planes are widened as they're loaded.  Without AVX2 and F16C, the scalar
+    // version widens them with OpenEXR's half to float table.
+    if(input == SAMPLE_FLOAT16 && output == SAMPLE_FLOAT32)
+    {
+        switch(requested)
+        {
+        case ISA_AVX512: return pick_layout<Avx512HalfRow>(channels, has_alpha, normals);
+        case ISA_AVX2: return pick_layout<Avx2HalfRow>(channels, has_alpha, normals);
+        case ISA_SSE2: case ISA_SCALAR: break;
+        }
+    }
+#endif
+    return row_converter_scalar(channels, has_alpha, normals, input, output);
+}
+
+RowConverter row_converter(int channels, bool has_alpha, bool normals, SampleType input, SampleType output)
+{
+    return row_converter_for_isa(isa(), channels, has_alpha, normals, input, output);
+}
+
+const char *row_converter_name()
+{
+    switch(isa())
+    {
+    case ISA_AVX512: return "avx512";
+    case ISA_AVX2: return "avx2";
+    case ISA_SSE2: return "sse2";
+    case ISA_SCALAR: break;
+    }
+    return "scalar";
+}
+
+}
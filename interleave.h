@@ -0,0 +1,83 @@
+// This file is in the public domain.
+#ifndef EXRTOTIFF_INTERLEAVE_H
+#define EXRTOTIFF_INTERLEAVE_H
+
+#include "exrtotiff.h"
+#include <stdint.h>
+
+namespace exrtotiff
+{
+
+// The sample types rows can be converted from and to.
+enum SampleType
+{
+    SAMPLE_FLOAT32,
+    SAMPLE_FLOAT16,
+    SAMPLE_UINT8,
+    SAMPLE_UINT16,
+};
+
+// How float values become integer samples.  They're clamped to [0,1], color channels are
+// encoded with the transfer curve (alpha stays linear), and the result is scaled to the
+// sample size and rounded.  NaNs become 0.
+struct Quantizer
+{
+    int bits = 16;
+    TransferCurve curve = TRANSFER_LINEAR;
+    float gamma = 2.2f;
+
+    uint16_t quantize(float v, bool alpha) const;
+};
+
+// Return a table of the quantized value of every half, indexed by its bits.  If normals
+// is set, values are mapped from [-1,+1] to [0,1] first.  Tables are built on first use
+// and kept, so batch conversions only build them once.
+const uint16_t *half_quantize_table(const Quantizer &quantizer, bool normals, bool alpha);
+
+// What row converters need besides the layout.  Only integer output uses these.
+struct RowParams
+{
+    // Used for FLOAT input.
+    const Quantizer *quantizer = NULL;
+
+    // Used for HALF input: half_quantize_table for color channels and for alpha, with
+    // normals remapped if the layout has normals.
+    const uint16_t *color_table = NULL, *alpha_table = NULL;
+};
+
+// Convert count pixels from one plane per channel to interleaved samples in out.  The
+// same plane can be given more than once, to fan a channel out to several outputs.
+typedef void (*RowConverter)(const void *const *planes, int count, void *out, const RowParams &params);
+
+// Return a converter for rows with this layout, reading planes of input samples and
+// writing output samples.  There's a separate instantiation for each layout, so nothing
+// is decided per pixel.  If has_alpha is set, the last channel is alpha.  If normals is
+// set, every channel, alpha included, is mapped from [-1,+1] to [0,1].  channels can be
+// 1 to 4.
+// Return NULL if converting between these sample types isn't supported.
+//
+// row_converter uses the fastest instructions the CPU supports.  The scalar versions are
+// the reference the others must match exactly.
+RowConverter row_converter(int channels, bool has_alpha, bool normals, SampleType input, SampleType output);
+RowConverter row_converter_scalar(int channels, bool has_alpha, bool normals, SampleType input, SampleType output);
+
+// The instruction sets row converters can use.
+enum Isa
+{
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_AVX512,
+};
+
+// Return the converter row_converter would use with a particular instruction set, or NULL
+// if the CPU doesn't support it.  Conversions without a vector version for isa use the
+// scalar one.  This lets the tests check every version against the scalar one.
+RowConverter row_converter_for_isa(Isa isa, int channels, bool has_alpha, bool normals, SampleType input, SampleType output);
+
+// The name of the instruction set row_converter uses, for --stats.
+const char *row_converter_name();
+
+}
+
+#endif
@@ -0,0 +1,1247 @@
+// This file is in the public domain.
+#include "exrtotiff.h"
+#include "threadpool.h"
+#include "interleave.h"
+#include <ImfMultiPartInputFile.h>
+#include <ImfInputPart.h>
+#include <ImfTiledInputPart.h>
+#include <ImfPartType.h>
+#include <ImfChannelList.h>
+#include <ImfThreading.h>
+#include <chrono>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+using namespace Imf;
+using namespace Imath;
+
+namespace exrtotiff
+{
+
+// OpenEXR's thread count is the number of worker threads in addition to the calling
+// thread, and 0 disables threading.  ConvertOptions::threads is the total.
+static int exr_thread_count(int threads)
+{
+    return threads > 1? threads: 0;
+}
+
+// Return the shared pool used to compress TIFF data.  Like OpenEXR's global thread pool,
+// it's shared by every conversion, including conversions running at the same time.  It's
+// created with thread_count threads the first time it's used, and never resized, since
+// other conversions may be using it.
+static ThreadPool &encode_pool(int thread_count)
+{
+    static mutex pool_lock;
+    static unique_ptr<ThreadPool> pool;
+
+    unique_lock<mutex> guard(pool_lock);
+    if(!pool)
+        pool.reset(new ThreadPool(thread_count));
+    return *pool;
+}
+
+size_t MemoryTiffSink::read(void *buf, size_t size)
+{
+    size_t bytes = min(size, data.size() - min(pos, data.size()));
+    if(bytes > 0)
+        memcpy(buf, &data[pos], bytes);
+    pos += bytes;
+    return bytes;
+}
+
+size_t MemoryTiffSink::write(const void *buf, size_t size)
+{
+    if(pos + size > data.size())
+        data.resize(pos + size);
+    memcpy(&data[pos], buf, size);
+    pos += size;
+    return size;
+}
+
+uint64_t MemoryTiffSink::seek(int64_t offset, int whence)
+{
+    if(whence == SEEK_CUR)
+        offset += pos;
+    else if(whence == SEEK_END)
+        offset += data.size();
+    pos = offset;
+    return offset;
+}
+
+MemoryIStream::MemoryIStream(const char *data_, size_t size, const char *name):
+    IStream(name),
+    data(data_),
+    data_size(size)
+{
+}
+
+bool MemoryIStream::read(char c[], int n)
+{
+    if(pos + n > data_size)
+        throw runtime_error(string("Unexpected end of file in ") + fileName());
+    memcpy(c, data + pos, n);
+    pos += n;
+    return pos < data_size;
+}
+
+char *MemoryIStream::readMemoryMapped(int n)
+{
+    if(pos + n > data_size)
+        throw runtime_error(string("Unexpected end of file in ") + fileName());
+    char *result = (char *) data + pos;
+    pos += n;
+    return result;
+}
+
+// An IStream that reads a file with mmap.  OpenEXR reads memory-mapped streams with
+// readMemoryMapped, which returns a pointer into the page cache instead of copying each
+// line block into a buffer with a read call.  Since there's no shared file position,
+// decode threads only hold OpenEXR's stream lock long enough to advance a pointer.
+//
+// If the file can't be mapped, such as on some network filesystems, or map is false, it's
+// read with pread instead.  The mapping is only safe while nothing truncates the file:
+// reading a page past the new end raises SIGBUS.
+class MappedFileIStream: public IStream
+{
+public:
+    MappedFileIStream(const string &filename, bool map):
+        IStream(filename.c_str())
+    {
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+            throw runtime_error("Couldn't open " + filename + ": " + strerror(errno));
+
+        struct stat st;
+        if(fstat(fd, &st) == -1)
+        {
+            int error = errno;
+            close(fd);
+            throw runtime_error("Couldn't read " + filename + ": " + strerror(error));
+        }
+        file_size = st.st_size;
+
+        void *result = map && file_size > 0? mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0): MAP_FAILED;
+        if(result != MAP_FAILED)
+        {
+            mapping = (char *) result;
+            madvise(mapping, file_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~MappedFileIStream()
+    {
+        if(mapping != NULL)
+            munmap(mapping, file_size);
+        close(fd);
+    }
+
+    bool isMemoryMapped() const { return mapping != NULL; }
+
+    bool read(char c[], int n)
+    {
+        if(pos + n > file_size)
+            throw runtime_error(string("Unexpected end of file in ") + fileName());
+
+        if(mapping != NULL)
+            memcpy(c, mapping + pos, n);
+        else
+        {
+            for(int done = 0; done < n; )
+            {
+                ssize_t bytes = pread(fd, c + done, n - done, pos + done);
+                if(bytes == -1 && errno == EINTR)
+                    continue;
+                if(bytes <= 0)
+                    throw runtime_error(string("Error reading ") + fileName() + ": " + (bytes == 0? "unexpected end of file": strerror(errno)));
+                done += bytes;
+            }
+        }
+
+        pos += n;
+        return pos < file_size;
+    }
+
+    char *readMemoryMapped(int n)
+    {
+        if(pos + n > file_size)
+            throw runtime_error(string("Unexpected end of file in ") + fileName());
+        char *result = mapping + pos;
+        pos += n;
+        return result;
+    }
+
+    Int64 tellg() { return pos; }
+    void seekg(Int64 new_pos) { pos = new_pos; }
+
+private:
+    int fd = -1;
+    char *mapping = NULL;
+    size_t file_size = 0;
+    size_t pos = 0;
+};
+
+// Open a TIFF for writing to a sink.
+static TIFF *open_tiff(TiffSink &sink, const char *name)
+{
+    struct Procs
+    {
+        static tmsize_t read(thandle_t handle, void *buf, tmsize_t size) { return ((TiffSink *) handle)->read(buf, size); }
+        static tmsize_t write(thandle_t handle, void *buf, tmsize_t size) { return ((TiffSink *) handle)->write(buf, size); }
+        static toff_t seek(thandle_t handle, toff_t offset, int whence) { return ((TiffSink *) handle)->seek(offset, whence); }
+        static int close(thandle_t) { return 0; }
+        static toff_t size(thandle_t handle) { return ((TiffSink *) handle)->size(); }
+        static int map(thandle_t, void **, toff_t *) { return 0; }
+        static void unmap(thandle_t, void *, toff_t) { }
+    };
+
+    return TIFFClientOpen(name, "w", (thandle_t) &sink, Procs::read, Procs::write, Procs::seek, Procs::close, Procs::size, Procs::map, Procs::unmap);
+}
+
+// A MemoryTiffSink that records the range of bytes written since reset_written was called.
+class RecordingTiffSink: public MemoryTiffSink
+{
+public:
+    size_t written_start = 0, written_end = 0;
+
+    size_t write(const void *buf, size_t size)
+    {
+        size_t start = seek(0, SEEK_CUR);
+        written_start = min(written_start, start);
+        written_end = max(written_end, start + size);
+        return MemoryTiffSink::write(buf, size);
+    }
+
+    void reset_written()
+    {
+        written_start = data.size();
+        written_end = 0;
+    }
+};
+
+// The layout of the TIFF we're writing.
+struct TiffFormat
+{
+    int width = 0, height = 0;
+    int channels = 0;
+    bool has_alpha = false;
+    int rows_per_strip = 1;
+
+    // If nonzero, the TIFF is tiled and rows_per_strip isn't used.
+    int tile_width = 0, tile_height = 0;
+
+    int compression = COMPRESSION_LZW;
+    int level = 0;
+    int predictor = PREDICTOR_NONE;
+
+    // 16 or 32-bit IEEE floats, or 8 or 16-bit unsigned integers.
+    int bits_per_sample = 32;
+    int sample_format = SAMPLEFORMAT_IEEEFP;
+
+    bool tiled() const { return tile_width != 0; }
+    int sample_bytes() const { return bits_per_sample / 8; }
+    int pixel_bytes() const { return channels * sample_bytes(); }
+    int row_bytes() const { return width * pixel_bytes(); }
+    int tile_bytes() const { return tile_width * tile_height * pixel_bytes(); }
+    int tiles_across() const { return (width + tile_width - 1) / tile_width; }
+
+    // The number of rows in each row of strips or tiles.
+    int chunk_rows() const { return tiled()? tile_height: rows_per_strip; }
+};
+
+static int gcd(int a, int b)
+{
+    while(b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static bool compression_supports_predictor(int compression)
+{
+    switch(compression)
+    {
+    case COMPRESSION_LZW:
+    case COMPRESSION_ADOBE_DEFLATE:
+#ifdef COMPRESSION_ZSTD
+    case COMPRESSION_ZSTD:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void set_tiff_fields(TIFF *tif, const TiffFormat &format)
+{
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, format.width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, format.height);
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, format.sample_format);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, format.channels);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, format.bits_per_sample);
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    if(format.tiled())
+    {
+        TIFFSetField(tif, TIFFTAG_TILEWIDTH, format.tile_width);
+        TIFFSetField(tif, TIFFTAG_TILELENGTH, format.tile_height);
+    }
+    else
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, format.rows_per_strip);
+
+    // We have RGB data if we have three color channels.
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (format.channels - format.has_alpha) == 3? PHOTOMETRIC_RGB:PHOTOMETRIC_MINISBLACK);
+    if(format.has_alpha)
+    {
+        uint16 data[] = {
+            EXTRASAMPLE_ASSOCALPHA
+        };
+
+        TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, data);
+    }
+
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, format.compression);
+    if(format.level != 0 && format.compression == COMPRESSION_ADOBE_DEFLATE)
+        TIFFSetField(tif, TIFFTAG_ZIPQUALITY, format.level);
+#ifdef COMPRESSION_ZSTD
+    if(format.level != 0 && format.compression == COMPRESSION_ZSTD)
+        TIFFSetField(tif, TIFFTAG_ZSTD_LEVEL, format.level);
+#endif
+
+    // The predictor tag only exists for codecs that support it.
+    if(compression_supports_predictor(format.compression))
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, format.predictor);
+}
+
+// Copy the tile in column tile_x out of a row of tiles, which has rows rows.  Tiles that
+// extend past the right or bottom of the image are padded by repeating the last column
+// and row, which compresses better than leaving them empty.
+static void copy_tile(const TiffFormat &format, const char *rows_data, int rows, int tile_x, char *tile)
+{
+    int pixel_bytes = format.pixel_bytes();
+    int x_start = tile_x * format.tile_width;
+    int columns = min(format.tile_width, format.width - x_start);
+    for(int y = 0; y < format.tile_height; ++y)
+    {
+        const char *src = rows_data + (min(y, rows - 1) * format.width + x_start) * pixel_bytes;
+        char *dst = tile + y * format.tile_width * pixel_bytes;
+        memcpy(dst, src, columns * pixel_bytes);
+        for(int x = columns; x < format.tile_width; ++x)
+            memcpy(dst + x * pixel_bytes, src + (columns - 1) * pixel_bytes, pixel_bytes);
+    }
+}
+
+// Compress one strip of rows rows, or one tile, returning the data TIFFWriteRawStrip or
+// TIFFWriteRawTile should write.
+//
+// libtiff's codecs can only be used through a TIFF, so this writes the strip or tile as
+// the only one in a scratch TIFF in memory with the same fields, and returns the bytes
+// libtiff wrote for it.  Strips and tiles are compressed independently, so this is
+// identical to what TIFFWriteEncodedStrip or TIFFWriteEncodedTile would write into the
+// real file.
+static vector<char> encode_chunk(const TiffFormat &format, const void *data, int rows)
+{
+    RecordingTiffSink file;
+    TIFF *tif = open_tiff(file, "chunk");
+    if(tif == NULL)
+        throw runtime_error("Error creating TIFF encoder.");
+
+    TiffFormat chunk_format = format;
+    if(format.tiled())
+    {
+        chunk_format.width = format.tile_width;
+        chunk_format.height = format.tile_height;
+    }
+    else
+    {
+        chunk_format.height = rows;
+        chunk_format.rows_per_strip = rows;
+    }
+    set_tiff_fields(tif, chunk_format);
+
+    file.reset_written();
+    bool failed;
+    if(format.tiled())
+        failed = TIFFWriteEncodedTile(tif, 0, (void *) data, format.tile_bytes()) < 0;
+    else
+        failed = TIFFWriteEncodedStrip(tif, 0, (void *) data, (tmsize_t) rows * format.row_bytes()) < 0;
+    size_t start = file.written_start, end = file.written_end;
+    TIFFClose(tif);
+
+    if(failed)
+        throw runtime_error("Error compressing TIFF data.");
+    if(end <= start)
+        return vector<char>();
+    return vector<char>(file.data.begin() + start, file.data.begin() + end);
+}
+
+// Return the number of scanlines OpenEXR compresses together for a compression type.
+// Reading a block that ends partway through one of these decompresses it twice, so
+// we keep our blocks aligned to it.
+static int lines_per_chunk(Compression compression)
+{
+    switch(compression)
+    {
+    case ZIP_COMPRESSION:
+    case PXR24_COMPRESSION:
+        return 16;
+    case PIZ_COMPRESSION:
+    case B44_COMPRESSION:
+    case B44A_COMPRESSION:
+    case DWAA_COMPRESSION:
+        return 32;
+    case DWAB_COMPRESSION:
+        return 256;
+    default:
+        return 1;
+    }
+}
+
+// Where EXR data is read from.  This is one part of a file, and hides the differences
+// between reading scanline and tiled parts.
+class ExrSource
+{
+public:
+    virtual ~ExrSource() { }
+
+    virtual const Header &header() const = 0;
+
+    // The data window of the image being read.
+    virtual Box2i data_window() const = 0;
+
+    // The number of rows that are decompressed together.  Reads aligned to this don't
+    // decompress the same data twice.
+    virtual int block_alignment() const = 0;
+
+    // Return the part of the frame buffer that read() fills when reading region.  Scanline
+    // files always fill whole rows, and tiled files fill whole tiles.
+    virtual Box2i read_window(const Box2i &region) const = 0;
+
+    // Read at least region into frame_buffer, which must cover read_window(region).
+    virtual void read(const FrameBuffer &frame_buffer, const Box2i &region) = 0;
+};
+
+class ScanlineSource: public ExrSource
+{
+public:
+    ScanlineSource(MultiPartInputFile &input, int part):
+        file(input, part)
+    {
+    }
+
+    const Header &header() const { return file.header(); }
+    Box2i data_window() const { return file.header().dataWindow(); }
+    int block_alignment() const { return lines_per_chunk(file.header().compression()); }
+
+    Box2i read_window(const Box2i &region) const
+    {
+        Box2i dw = data_window();
+        return Box2i(V2i(dw.min.x, region.min.y), V2i(dw.max.x, region.max.y));
+    }
+
+    void read(const FrameBuffer &frame_buffer, const Box2i &region)
+    {
+        file.setFrameBuffer(frame_buffer);
+        file.readPixels(region.min.y, region.max.y);
+    }
+
+private:
+    InputPart file;
+};
+
+// Tiled parts are read with TiledInputPart, so only the tiles that intersect the region
+// being read are decompressed.  InputPart would decompress every tile in each row.
+//
+// A mip or rip level other than the full-resolution one can be selected, which reads the
+// pre-filtered level directly.  OpenEXR decompresses the tiles of each read on its own
+// thread pool, so tiles are decoded in parallel.
+class TiledSource: public ExrSource
+{
+public:
+    TiledSource(MultiPartInputFile &input, int part, int level_x, int level_y):
+        file(input, part),
+        level_x(level_x),
+        level_y(level_y)
+    {
+        if(!file.isValidLevel(level_x, level_y))
+        {
+            char message[256];
+            if(file.levelMode() == ONE_LEVEL)
+                snprintf(message, sizeof(message), "This file has no mip levels.");
+            else if(file.levelMode() == MIPMAP_LEVELS)
+                snprintf(message, sizeof(message), "This file has mip levels 0-%i.", file.numLevels() - 1);
+            else
+                snprintf(message, sizeof(message), "This file has rip levels 0-%i,0-%i.", file.numXLevels() - 1, file.numYLevels() - 1);
+            throw runtime_error(message);
+        }
+    }
+
+    const Header &header() const { return file.header(); }
+    Box2i data_window() const { return file.dataWindowForLevel(level_x, level_y); }
+    int block_alignment() const { return file.tileYSize(); }
+
+    Box2i read_window(const Box2i &region) const
+    {
+        int dx1, dx2, dy1, dy2;
+        tile_range(region, dx1, dx2, dy1, dy2);
+        Box2i first = file.dataWindowForTile(dx1, dy1, level_x, level_y);
+        Box2i last = file.dataWindowForTile(dx2, dy2, level_x, level_y);
+        return Box2i(first.min, last.max);
+    }
+
+    void read(const FrameBuffer &frame_buffer, const Box2i &region)
+    {
+        int dx1, dx2, dy1, dy2;
+        tile_range(region, dx1, dx2, dy1, dy2);
+        file.setFrameBuffer(frame_buffer);
+        file.readTiles(dx1, dx2, dy1, dy2, level_x, level_y);
+    }
+
+private:
+    // Return the range of tiles that intersect region.
+    void tile_range(const Box2i &region, int &dx1, int &dx2, int &dy1, int &dy2) const
+    {
+        Box2i dw = data_window();
+        dx1 = (region.min.x - dw.min.x) / file.tileXSize();
+        dx2 = (region.max.x - dw.min.x) / file.tileXSize();
+        dy1 = (region.min.y - dw.min.y) / file.tileYSize();
+        dy2 = (region.max.y - dw.min.y) / file.tileYSize();
+    }
+
+    TiledInputPart file;
+    int level_x, level_y;
+};
+
+static unique_ptr<ExrSource> open_part(MultiPartInputFile &file, int part, const ConvertOptions &options)
+{
+    const Header &header = file.header(part);
+    if(header.hasType() && isDeepData(header.type()))
+        throw runtime_error("Deep EXR data isn't supported.");
+
+    if(header.hasTileDescription())
+        return unique_ptr<ExrSource>(new TiledSource(file, part, options.mip_level_x, options.mip_level_y));
+
+    if(options.mip_level_x != 0 || options.mip_level_y != 0)
+        throw runtime_error("Only tiled files have mip levels.");
+    return unique_ptr<ExrSource>(new ScanlineSource(file, part));
+}
+
+// Return the index of a part, given its name or index.
+static int find_part(const MultiPartInputFile &file, const string &name)
+{
+    for(int part = 0; part < file.parts(); ++part)
+    {
+        if(file.header(part).hasName() && file.header(part).name() == name)
+            return part;
+    }
+
+    char *end;
+    long part = strtol(name.c_str(), &end, 10);
+    if(name.empty() || *end != 0 || part < 0 || part >= file.parts())
+        throw runtime_error("The file has no part named " + name + ".");
+    return part;
+}
+
+// Return the name to use for a part in output filenames: the part's name, or its index if
+// it doesn't have one.
+static string part_name(const MultiPartInputFile &file, int part)
+{
+    if(!file.header(part).hasName())
+        return to_string(part);
+    return file.header(part).name();
+}
+
+// Return name with characters that don't belong in filenames replaced.
+static string filename_safe(string name)
+{
+    for(char &c: name)
+    {
+        if(!isalnum((unsigned char) c) && c != '-' && c != '_' && c != '.')
+            c = '_';
+    }
+    return name;
+}
+
+// Return the output filename for a part and layer.  {part} and {layer} in the filename are
+// replaced with their names.  Names without a placeholder are added before the extension,
+// so "out.tif" becomes "out.beauty.tif".  Empty names are left out.
+static string output_filename_for(string filename, const string &part, const string &layer)
+{
+    string suffix;
+    const pair<string, string> names[] = { { "{part}", part }, { "{layer}", layer } };
+    for(const auto &name: names)
+    {
+        size_t pos = filename.find(name.first);
+        if(pos != string::npos)
+            filename.replace(pos, name.first.size(), filename_safe(name.second));
+        else if(!name.second.empty())
+            suffix += "." + filename_safe(name.second);
+    }
+
+    size_t slash = filename.rfind('/');
+    size_t dot = filename.rfind('.');
+    if(dot == string::npos || (slash != string::npos && dot < slash))
+        return filename + suffix;
+    return filename.insert(dot, suffix);
+}
+
+// One TIFF being written from the input.  Normally there's one, with every channel we can
+// output, but when splitting layers there's one for each layer.
+struct OutputLayer
+{
+    // The layer's name in output filenames.
+    string name;
+
+    // The input channel for each slice we read, and for channels that are filled by
+    // copying another, the output channel to copy from, or -1.
+    vector<string> input_channels;
+    vector<int> copy_from;
+    bool fan_out = false;
+    bool convert_normals = false;
+    bool has_alpha = false;
+
+    // When reading into planes, the plane each output channel comes from.  Fanned out
+    // channels share a plane.
+    vector<int> plane_of;
+    int planes_used = 0;
+
+    // The type channels are decoded as.
+    PixelType read_type = FLOAT;
+    SampleType read_sample = SAMPLE_FLOAT32;
+    int read_bytes = sizeof(float);
+
+    // Whether the decoded data needs more than OpenEXR can do while decoding, so we
+    // read into planes and convert them with convert_row.
+    bool needs_conversion = false;
+
+    // Interleaves the planes into the block.  This is chosen once for the layer's layout,
+    // so there's nothing to decide per pixel.
+    RowConverter convert_row = NULL;
+    RowParams row_params;
+
+    TiffFormat format;
+    TIFF *tif = NULL;
+
+    // The interleaved block we write from, and the planes we read into when the data
+    // needs more than OpenEXR can do while decoding.
+    vector<char> *block = NULL;
+    vector<char> *planes = NULL;
+};
+
+// Report a problem that doesn't stop the conversion through options.warning.
+static void warn(const ConvertOptions &options, const string &message)
+{
+    if(options.warning)
+        options.warning(message);
+}
+
+// Map the input channels to a layer's output channels.  channel_list holds full input
+// channel names, like "ABC:def.NX".  Return false if none of them can be output.
+static bool map_channels(const vector<string> &channel_list, OutputLayer &layer, const ConvertOptions &options)
+{
+    // Map from input channels to output channels.  For example, NX/NY/NZ in a normal
+    // map image is mapped to RGB.
+    map<string,string> channel_map = {
+        { "Z", "Y" },
+        { "Y", "Y" },
+        { "R", "R" },
+        { "G", "G" },
+        { "B", "B" },
+        { "NX", "R" },
+        { "NY", "G" },
+        { "NZ", "B" },
+        { "A", "A" },
+    };
+
+    // Make a map from output channels to input channels.
+    map<string, string> channel_names;
+    for(const string &input_name: channel_list)
+    {
+        // The channel name looks like "ABC:def.NX".  Pull out the value after the period,
+        // or the whole string if there's no period.
+        string channel_name = input_name;
+        size_t idx = channel_name.find_last_of('.');
+        if(idx != channel_name.npos)
+            channel_name = channel_name.substr(idx+1);
+
+        // If this is a normals channel, set convert_normals.
+        if(channel_name == "NX")
+            layer.convert_normals = true;
+
+        if(channel_map.find(channel_name) == channel_map.end())
+        {
+            warn(options, "Unknown channel: " + input_name);
+            continue;
+        }
+
+        string new_name = channel_map[channel_name];
+
+        if(channel_names.find(new_name) != channel_names.end())
+        {
+            string layer_name = layer.name.empty()? "": " in layer " + layer.name;
+            throw runtime_error("More than one channel" + layer_name + " was found that maps to the output channel " + new_name + ".");
+        }
+
+        // As a special case, convert "Y" (monochrome) to R, G, B output channels.  Maya doesn't
+        // seem to support 32-bit monochrome TIFFs.
+        if(new_name == "Y")
+        {
+            channel_names["R"] = input_name;
+            channel_names["G"] = input_name;
+            channel_names["B"] = input_name;
+        }
+        else
+        {
+            // Store the channel that we'll get this output channel from.  Use the whole layer name,
+            // not just the data type portion that we parsed out.
+            channel_names[new_name] = input_name;
+        }
+    }
+
+    if(channel_names.empty())
+        return false;
+
+    // Request the channels we're outputting from the EXR.  Channels that aren't mapped to
+    // an output channel aren't requested, so they're never decompressed.  We normally request
+    // FLOAT, which will convert 16-bit floats to 32-bit for us, since 16-bit floats are
+    // rarely supported.  This will also convert 32-bit ints, which isn't ideal, but that's
+    // less commonly used.  16-bit and integer output can request HALF instead.
+    //
+    // It would be easy to request multiple alpha channels and output them to more EXTRASAMPLES,
+    // but without use cases we won't know what to do with them, so for now just handle regular
+    // alpha.
+    //
+    // Each output channel's slice points into a single interleaved buffer, so OpenEXR
+    // decodes straight into the layout TIFF wants and we don't need a separate interleave
+    // pass.  A FrameBuffer can only have one slice per channel, so when an input channel
+    // is used by more than one output channel (a "Y" channel fanned out to RGB), it's read
+    // into the first one and copied to the others in place.
+    for(string channel_name: {"R", "G", "B", "A"})
+    {
+        if(channel_names.find(channel_name) == channel_names.end())
+            continue;
+
+        string input_channel_name = channel_names.at(channel_name);
+        auto existing = find(layer.input_channels.begin(), layer.input_channels.end(), input_channel_name);
+        layer.copy_from.push_back(existing == layer.input_channels.end()? -1: int(existing - layer.input_channels.begin()));
+        layer.input_channels.push_back(input_channel_name);
+    }
+
+    layer.fan_out = count(layer.copy_from.begin(), layer.copy_from.end(), -1) != (int) layer.copy_from.size();
+    layer.has_alpha = channel_names.find("A") != channel_names.end();
+
+    for(int from: layer.copy_from)
+        layer.plane_of.push_back(from == -1? layer.planes_used++: layer.plane_of[from]);
+    return true;
+}
+
+// Convert an opened EXR.  open_output is called to open each TIFF once we know the EXR
+// can be converted, with the layer's name if options.split_layers is set, otherwise with
+// an empty name.  input_name is used for messages.
+static void convert_file(ExrSource &source, const string &input_name, function<TIFF *(const string &layer_name)> open_output, const ConvertOptions &options)
+{
+    const Header &header = source.header();
+
+    // The region we're outputting: the data window, or the part of it inside the crop.
+    Box2i dw = source.data_window();
+    if(options.crop_width > 0 && options.crop_height > 0)
+    {
+        dw.min.x = max(dw.min.x, options.crop_x);
+        dw.min.y = max(dw.min.y, options.crop_y);
+        dw.max.x = min(dw.max.x, options.crop_x + options.crop_width - 1);
+        dw.max.y = min(dw.max.y, options.crop_y + options.crop_height - 1);
+        if(dw.isEmpty())
+            throw runtime_error("The crop region doesn't overlap the image.");
+    }
+
+    int width  = dw.max.x - dw.min.x + 1;
+    int height = dw.max.y - dw.min.y + 1;
+
+    // Group the input channels into layers.  If we're not splitting layers, every channel
+    // goes into one output.  Otherwise, channels are grouped by the layer prefix before the
+    // last period, so "diffuse.R" and "diffuse.G" go together.  Channels with no prefix
+    // go in the "rgba" layer.
+    map<string, vector<string>> layer_channels;
+    for(auto it = header.channels().begin(); it != header.channels().end(); ++it)
+    {
+        string layer_name;
+        if(options.split_layers)
+        {
+            string channel_name = it.name();
+            size_t idx = channel_name.find_last_of('.');
+            layer_name = idx != channel_name.npos? channel_name.substr(0, idx): "rgba";
+        }
+        layer_channels[layer_name].push_back(it.name());
+    }
+
+    vector<OutputLayer> layers;
+    for(const auto &it: layer_channels)
+    {
+        OutputLayer layer;
+        layer.name = it.first;
+        if(map_channels(it.second, layer, options))
+            layers.push_back(move(layer));
+        else if(options.split_layers)
+            warn(options, "Layer " + it.first + " has no channels that can be output");
+    }
+
+    if(layers.empty())
+        throw runtime_error("No channels were found that can be output.");
+
+    // Use strips of around 128 KB by default.  Each strip is compressed separately and has
+    // its own entry in the strip tables, so one-row strips compress poorly and make the file
+    // slower to read, but very large strips make readers decompress more than they need.
+    // All layers use the same strip size, so a block always holds whole strips of each,
+    // and it's based on the layer with the most channels.
+    int max_channels = 0;
+    for(const OutputLayer &layer: layers)
+        max_channels = max(max_channels, (int) layer.input_channels.size());
+
+    SampleType output_sample = SAMPLE_FLOAT32;
+    int bits_per_sample = 32, sample_format = SAMPLEFORMAT_IEEEFP;
+    switch(options.output_type)
+    {
+    case OUTPUT_FLOAT32: break;
+    case OUTPUT_FLOAT16: output_sample = SAMPLE_FLOAT16; bits_per_sample = 16; break;
+    case OUTPUT_UINT8: output_sample = SAMPLE_UINT8; bits_per_sample = 8; sample_format = SAMPLEFORMAT_UINT; break;
+    case OUTPUT_UINT16: output_sample = SAMPLE_UINT16; bits_per_sample = 16; sample_format = SAMPLEFORMAT_UINT; break;
+    }
+    bool integer_output = sample_format == SAMPLEFORMAT_UINT;
+
+    // Automatic strip sizes are also snapped to a divisor or multiple of the rows the EXR
+    // compresses together, so blocks that hold whole strips also hold whole EXR chunks
+    // without growing much.
+    int rows_per_strip = options.rows_per_strip;
+    if(rows_per_strip == 0)
+    {
+        int alignment = source.block_alignment();
+        rows_per_strip = max(128*1024 / (width * max_channels * bits_per_sample / 8), 1);
+        if(rows_per_strip >= alignment)
+            rows_per_strip -= rows_per_strip % alignment;
+        else
+        {
+            while(alignment % rows_per_strip != 0)
+                rows_per_strip--;
+        }
+    }
+    rows_per_strip = min(rows_per_strip, height);
+
+    // The floating-point predictor separates the bytes of each float, so the slowly
+    // changing sign, exponent and high mantissa bytes compress well, but it's off by
+    // default, since we haven't checked that Maya reads it.  It only works on floats.
+    int predictor = options.predictor;
+    if(predictor == PREDICTOR_FLOATINGPOINT && integer_output)
+        throw runtime_error("The floating-point predictor can't be used with integer output.");
+
+    if(!TIFFIsCODECConfigured(options.compression))
+        throw runtime_error("This libtiff doesn't support the requested compression.");
+
+    Quantizer quantizer;
+    quantizer.bits = bits_per_sample;
+    quantizer.curve = options.transfer;
+    quantizer.gamma = options.gamma;
+
+    for(OutputLayer &layer: layers)
+    {
+        TiffFormat &format = layer.format;
+        format.width = width;
+        format.height = height;
+        format.channels = layer.input_channels.size();
+        format.has_alpha = layer.has_alpha;
+        format.rows_per_strip = rows_per_strip;
+        format.tile_width = options.tile_width;
+        format.tile_height = options.tile_height;
+        format.predictor = predictor;
+        format.compression = options.compression;
+        format.level = options.level;
+        format.bits_per_sample = bits_per_sample;
+        format.sample_format = sample_format;
+
+        // 16-bit float output is decoded as HALF, so HALF data stays 16-bit the whole way
+        // through.  Otherwise, if all of the layer's channels are HALF, they're decoded as
+        // HALF and widened while interleaving, with F16C where the CPU has it, or quantized
+        // by table lookup for integer output.  This halves what the decoder writes and we
+        // read back, and skips OpenEXR's own conversion.  Layers with FLOAT or UINT channels
+        // are decoded as FLOAT.
+        bool read_half = options.output_type == OUTPUT_FLOAT16;
+        if(!read_half)
+        {
+            read_half = true;
+            for(const string &name: layer.input_channels)
+            {
+                const Channel *channel = header.channels().findChannel(name.c_str());
+                if(channel == NULL || channel->type != HALF)
+                    read_half = false;
+            }
+        }
+
+        layer.read_type = read_half? HALF: FLOAT;
+        layer.read_sample = read_half? SAMPLE_FLOAT16: SAMPLE_FLOAT32;
+        layer.read_bytes = read_half? 2: 4;
+        layer.needs_conversion = layer.fan_out || layer.convert_normals || layer.read_sample != output_sample;
+        layer.convert_row = row_converter(format.channels, layer.has_alpha, layer.convert_normals, layer.read_sample, output_sample);
+        if(layer.convert_row == NULL)
+            throw runtime_error("This conversion isn't supported.");
+
+        if(integer_output)
+        {
+            layer.row_params.quantizer = &quantizer;
+            if(read_half)
+            {
+                layer.row_params.color_table = half_quantize_table(quantizer, layer.convert_normals, false);
+                layer.row_params.alpha_table = half_quantize_table(quantizer, layer.convert_normals, true);
+            }
+        }
+    }
+
+    // Close the files if we throw.
+    vector<unique_ptr<TIFF, void(*)(TIFF *)>> tif_closers;
+    for(OutputLayer &layer: layers)
+    {
+        // On error, libtiff prints an error.
+        layer.tif = open_output(options.split_layers? layer.name: "");
+        if(layer.tif == NULL)
+            throw runtime_error("Error opening output file.");
+
+        tif_closers.push_back(unique_ptr<TIFF, void(*)(TIFF *)>(layer.tif, TIFFClose));
+        set_tiff_fields(layer.tif, layer.format);
+    }
+
+    // If we're compressing in parallel, make sure each block has enough strips or tiles
+    // to keep the encoding threads busy.
+    const TiffFormat &first_format = layers[0].format;
+    ThreadPool *pool = options.encode_threads > 1? &encode_pool(options.encode_threads): NULL;
+    int chunk_rows = first_format.chunk_rows();
+    int chunks_per_row = first_format.tiled()? first_format.tiles_across(): 1;
+    int min_block_rows = options.block_rows;
+    if(pool != NULL)
+        min_block_rows = max(min_block_rows, chunk_rows * ((options.encode_threads + chunks_per_row - 1) / chunks_per_row));
+
+    // Round the block size up to a multiple of both the compressed EXR chunk height and
+    // the height of a row of strips or tiles, so no EXR chunk is decompressed twice and
+    // every strip or tile we write is complete.  If the two only line up every few
+    // thousand rows, like 255-row strips in a DWAB file, that could be the whole image,
+    // so past a few chunks we only round to whole strips and let the odd EXR chunk be
+    // decompressed twice.  That's much cheaper than buffering the whole frame.
+    int alignment = source.block_alignment();
+    int block_multiple = alignment / gcd(alignment, chunk_rows) * chunk_rows;
+    if(block_multiple > 4 * max(alignment, chunk_rows))
+    {
+        min_block_rows = max(min_block_rows, alignment);
+        block_multiple = chunk_rows;
+    }
+    int block_rows = ((min_block_rows + block_multiple - 1) / block_multiple) * block_multiple;
+
+    // EXR chunks and tiles are counted from the top of the data window, not the crop, so
+    // if the crop starts partway through a chunk, make the first block short enough that
+    // it ends on a chunk boundary, and the rest of the blocks line up with the file.  The
+    // first block still has to be whole strips, so this only works if some chunk boundary
+    // is also a strip boundary.  If none is, every block splits a chunk, as before.
+    int first_block_rows = block_rows;
+    int phase = (dw.min.y - source.data_window().min.y) % alignment;
+    if(phase != 0)
+    {
+        for(int rows = chunk_rows; rows <= block_multiple; rows += chunk_rows)
+        {
+            if((phase + rows) % alignment == 0)
+            {
+                first_block_rows = rows + block_rows - block_multiple;
+                break;
+            }
+        }
+    }
+
+    if(!first_format.tiled())
+        block_rows = min(block_rows, height);
+
+    // Read the image a block of scanlines at a time and output the data.  Each layer has
+    // a buffer that only holds one block, and all of them are filled by one read, so the
+    // file is only decompressed once however many layers we're writing.
+    //
+    // When we can, OpenEXR decodes straight into the interleaved block.  If the layer
+    // has channels to fan out, normals to remap or samples to convert, or the read covers
+    // more than the block (scanline files are read a whole row at a time and tiled files
+    // a whole tile at a time, so this happens when cropping), we read into one plane per
+    // channel instead, and a single interleave pass does all of it.
+    //
+    // The buffers are kept between conversions on the same thread, so batch, watch and
+    // server jobs don't allocate new ones and fault them in for every file.
+    struct LayerBuffers
+    {
+        vector<char> block, planes;
+    };
+    static thread_local vector<LayerBuffers> buffer_cache;
+    vector<LayerBuffers> &buffers = buffer_cache;
+    if(buffers.size() < layers.size())
+        buffers.resize(layers.size());
+    for(size_t i = 0; i < layers.size(); ++i)
+    {
+        layers[i].block = &buffers[i].block;
+        layers[i].planes = &buffers[i].planes;
+    }
+
+    chrono::steady_clock::duration decode_time(0), encode_time(0);
+    bool failed = false;
+    int block_end = 0;
+    for(int block_start = 0; block_start < height; block_start = block_end)
+    {
+        block_end = min(block_start == 0? first_block_rows: block_start + block_rows, height);
+        Box2i region(V2i(dw.min.x, dw.min.y + block_start), V2i(dw.max.x, dw.min.y + block_end - 1));
+        Box2i read_window = source.read_window(region);
+        int read_width = read_window.max.x - read_window.min.x + 1;
+        int read_height = read_window.max.y - read_window.min.y + 1;
+
+        // The read can only go straight into the block if it covers exactly the block's
+        // rows.  Tiled reads fill every row of the tiles they touch, which can run past
+        // the end of the block.
+        bool read_is_block = read_width == width && read_window.min.y == region.min.y && read_window.max.y == region.max.y;
+        size_t plane_size = (size_t) read_width * read_height;
+
+        // Point each slice at its channel in its layer's block or planes, offset so the
+        // first row of the read lands at the start of the buffer.
+        FrameBuffer frameBuffer;
+        for(OutputLayer &layer: layers)
+        {
+            int channels = layer.format.channels;
+            vector<char> &block = *layer.block;
+            vector<char> &planes = *layer.planes;
+            block.resize(max(block.size(), (size_t) (block_end - block_start) * layer.format.row_bytes()));
+
+            bool planar = layer.needs_conversion || !read_is_block;
+            if(planar)
+                planes.resize(max(planes.size(), plane_size * layer.planes_used * layer.read_bytes));
+
+            for(int c = 0; c < channels; ++c)
+            {
+                if(layer.copy_from[c] != -1)
+                    continue;
+
+                char *data = planar? &planes[layer.plane_of[c] * plane_size * layer.read_bytes]: &block[c * layer.read_bytes];
+                size_t xstride = layer.read_bytes * (planar? 1: channels), ystride = xstride * read_width;
+                char *base = data - read_window.min.x * xstride - read_window.min.y * ystride;
+                frameBuffer.insert(layer.input_channels[c].c_str(), Slice(layer.read_type, base, xstride, ystride, 1, 1, 0.0));
+            }
+        }
+
+        auto decode_start = chrono::steady_clock::now();
+        source.read(frameBuffer, region);
+        decode_time += chrono::steady_clock::now() - decode_start;
+
+        auto encode_start = chrono::steady_clock::now();
+        for(OutputLayer &layer: layers)
+        {
+            const TiffFormat &format = layer.format;
+            int channels = format.channels;
+            vector<char> &block = *layer.block;
+            TIFF *tif = layer.tif;
+
+            // If we read into planes, interleave the part of each row we're outputting
+            // into the block, fanning out channels, remapping normals and converting
+            // samples on the way.
+            if(layer.needs_conversion || !read_is_block)
+            {
+                int x_offset = region.min.x - read_window.min.x;
+                int y_offset = region.min.y - read_window.min.y;
+                const void *row_planes[4];
+                for(int y = 0; y < block_end - block_start; ++y)
+                {
+                    size_t row_start = (size_t) (y + y_offset) * read_width + x_offset;
+                    for(int c = 0; c < channels; ++c)
+                        row_planes[c] = &(*layer.planes)[(layer.plane_of[c] * plane_size + row_start) * layer.read_bytes];
+                    layer.convert_row(row_planes, width, &block[(size_t) y * format.row_bytes()], layer.row_params);
+                }
+            }
+
+            int first_chunk = (block_start / chunk_rows) * chunks_per_row;
+            int chunks = ((block_end - block_start + chunk_rows - 1) / chunk_rows) * chunks_per_row;
+
+            // Return the data for a chunk in this block.  Strips are written straight from the
+            // block, and tiles are copied out into tile_buffer.
+            auto chunk_data = [&](int i, vector<char> &tile_buffer, int &rows) -> char * {
+                int y = (i / chunks_per_row) * chunk_rows;
+                rows = min(chunk_rows, block_end - block_start - y);
+                char *rows_data = &block[(size_t) y * format.row_bytes()];
+                if(!format.tiled())
+                    return rows_data;
+
+                tile_buffer.resize(format.tile_bytes());
+                copy_tile(format, rows_data, rows, i % chunks_per_row, &tile_buffer[0]);
+                return &tile_buffer[0];
+            };
+
+            if(pool != NULL)
+            {
+                // Compress the block's strips or tiles in parallel, then write them in order.
+                vector<vector<char> > encoded(chunks);
+                pool->parallel_for(chunks, [&](int i) {
+                    vector<char> tile_buffer;
+                    int rows;
+                    char *data = chunk_data(i, tile_buffer, rows);
+                    encoded[i] = encode_chunk(format, data, rows);
+                });
+
+                for(int i = 0; i < chunks && !failed; ++i)
+                {
+                    tmsize_t result = format.tiled()?
+                        TIFFWriteRawTile(tif, first_chunk + i, encoded[i].data(), encoded[i].size()):
+                        TIFFWriteRawStrip(tif, first_chunk + i, encoded[i].data(), encoded[i].size());
+                    if(result < 0)
+                        failed = true;
+                }
+            }
+            else
+            {
+                vector<char> tile_buffer;
+                for(int i = 0; i < chunks && !failed; ++i)
+                {
+                    // The last strip in the image may be short.
+                    int rows;
+                    char *data = chunk_data(i, tile_buffer, rows);
+                    tmsize_t result = format.tiled()?
+                        TIFFWriteEncodedTile(tif, first_chunk + i, data, format.tile_bytes()):
+                        TIFFWriteEncodedStrip(tif, first_chunk + i, data, (tmsize_t) rows * format.row_bytes());
+                    if(result < 0)
+                        failed = true;
+                }
+            }
+
+            if(failed)
+                break;
+        }
+
+        encode_time += chrono::steady_clock::now() - encode_start;
+        if(failed)
+            break;
+    }
+
+    tif_closers.clear();
+
+    if(failed)
+        throw runtime_error("Error writing output file.");
+
+    if(options.stats)
+    {
+        // Throughput is measured in decoded bytes, so it's comparable between input files
+        // with different compression.
+        int channels = 0;
+        for(const OutputLayer &layer: layers)
+            channels += layer.format.channels;
+
+        double megabytes = double(width) * height * channels * bits_per_sample / 8 / (1024*1024);
+        double decode_seconds = chrono::duration<double>(decode_time).count();
+        double encode_seconds = chrono::duration<double>(encode_time).count();
+        char buf[256];
+        snprintf(buf, sizeof(buf), ": %ix%i, %i channels, %i layers, %i decode threads, %i encode threads, %s interleave\n",
+            width, height, channels, (int) layers.size(), options.threads, options.encode_threads, row_converter_name());
+        string text = input_name + buf;
+        snprintf(buf, sizeof(buf), "  decode: %.3fs (%.1f MB/s)\n", decode_seconds, megabytes / max(decode_seconds, 1e-9));
+        text += buf;
+        snprintf(buf, sizeof(buf), "  encode: %.3fs (%.1f MB/s)\n", encode_seconds, megabytes / max(encode_seconds, 1e-9));
+        text += buf;
+
+        if(options.stats_output)
+            options.stats_output(text);
+        else
+            fprintf(stderr, "%s", text.c_str());
+    }
+}
+
+void set_global_thread_count(int threads)
+{
+    setGlobalThreadCount(exr_thread_count(threads));
+}
+
+// Convert the selected part of an EXR.  If options.split_parts is set, convert each selected
+// part to its own output.  open_output is called with the part's name if parts are split
+// and the layer's name if layers are split, and empty names otherwise.
+static void convert_stream(IStream &input, const string &input_name, function<TIFF *(const string &part_name, const string &layer_name)> open_output, const ConvertOptions &options)
+{
+    MultiPartInputFile file(input, exr_thread_count(options.threads));
+    if(!options.split_parts)
+    {
+        if(options.parts.size() > 1)
+            throw runtime_error("Only one part can be converted unless parts are split.");
+
+        int part = options.parts.empty()? 0: find_part(file, options.parts[0]);
+        unique_ptr<ExrSource> source = open_part(file, part, options);
+        convert_file(*source, input_name, [&](const string &layer_name) { return open_output("", layer_name); }, options);
+        return;
+    }
+
+    vector<int> parts;
+    if(options.parts.empty())
+    {
+        for(int part = 0; part < file.parts(); ++part)
+            parts.push_back(part);
+    }
+    else
+    {
+        for(const string &name: options.parts)
+            parts.push_back(find_part(file, name));
+    }
+
+    // Convert the parts at the same time.  They all read from the one open file, which
+    // OpenEXR allows as long as each part has its own reader.
+    ThreadPool pool(max(min((int) parts.size(), options.threads), 1));
+    pool.parallel_for(parts.size(), [&](int i) {
+        int part = parts[i];
+        unique_ptr<ExrSource> source = open_part(file, part, options);
+        string name = part_name(file, part);
+        try {
+            convert_file(*source, input_name, [&](const string &layer_name) { return open_output(name, layer_name); }, options);
+        } catch(exception &e) {
+            throw runtime_error("Part " + name + ": " + e.what());
+        }
+    });
+}
+
+void convert(const string &input_filename, const string &output_filename, const ConvertOptions &options)
+{
+    MappedFileIStream input(input_filename, options.memory_map);
+    convert(input, output_filename, options);
+}
+
+void convert(IStream &input, TiffSink &output, const ConvertOptions &options)
+{
+    if(options.split_parts || options.split_layers)
+        throw runtime_error("Splitting parts or layers needs an output filename.");
+    convert_stream(input, input.fileName(), [&](const string &, const string &) { return open_tiff(output, "output"); }, options);
+}
+
+void convert(IStream &input, const string &output_filename, const ConvertOptions &options)
+{
+    convert_stream(input, input.fileName(), [&](const string &part_name, const string &layer_name) {
+        string filename = output_filename_for(output_filename, part_name, layer_name);
+        return TIFFOpen(filename.c_str(), "w");
+    }, options);
+}
+
+void convert(const string &input_filename, TiffSink &output, const ConvertOptions &options)
+{
+    MappedFileIStream input(input_filename, options.memory_map);
+    convert(input, output, options);
+}
+
+vector<char> convert(const char *data, size_t size, const ConvertOptions &options)
+{
+    MemoryIStream input(data, size);
+    MemoryTiffSink output;
+    convert(input, output, options);
+    return move(output.data);
+}
+
+}
@@ -0,0 +1,245 @@
+// This file is in the public domain.
+//
+// Convert small generated EXRs and check that every output pixel matches the input.
+// This covers the block and crop arithmetic in convert_file: scanline and tiled input,
+// blocks that end partway through a tile, and crops that start and end inside tiles.
+// Build with -fsanitize=address (make test does) to catch decodes that overrun a buffer.
+#include "exrtotiff.h"
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
+#include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <half.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+using namespace Imf;
+using namespace Imath;
+using namespace exrtotiff;
+
+// The value of channel c at x, y.  These are exact in HALF, so HALF and FLOAT input give
+// the same output.
+static float pixel_value(int x, int y, int c)
+{
+    return ((x + 3*y + 7*c) % 256) / 8.0f;
+}
+
+struct TestCase
+{
+    const char *name;
+    PixelType type;
+    int width, height;
+
+    // Zero for a scanline file.
+    int tile_size;
+
+    ConvertOptions options;
+};
+
+// Write an RGB EXR filled with pixel_value.
+static void write_exr(const string &filename, const TestCase &test)
+{
+    Header header(test.width, test.height);
+    const char *names[] = { "R", "G", "B" };
+    for(const char *name: names)
+        header.channels().insert(name, Channel(test.type));
+
+    vector<float> float_data(test.width * test.height * 3);
+    vector<half> half_data(float_data.size());
+    for(int y = 0; y < test.height; ++y)
+    {
+        for(int x = 0; x < test.width; ++x)
+        {
+            for(int c = 0; c < 3; ++c)
+            {
+                float_data[(y*test.width + x)*3 + c] = pixel_value(x, y, c);
+                half_data[(y*test.width + x)*3 + c] = pixel_value(x, y, c);
+            }
+        }
+    }
+
+    size_t sample_size = test.type == HALF? sizeof(half): sizeof(float);
+    char *base = test.type == HALF? (char *) half_data.data(): (char *) float_data.data();
+    FrameBuffer frame_buffer;
+    for(int c = 0; c < 3; ++c)
+        frame_buffer.insert(names[c], Slice(test.type, base + c*sample_size, sample_size*3, sample_size*3*test.width));
+
+    if(test.tile_size != 0)
+    {
+        header.setTileDescription(TileDescription(test.tile_size, test.tile_size, ONE_LEVEL));
+        TiledOutputFile file(filename.c_str(), header);
+        file.setFrameBuffer(frame_buffer);
+        file.writeTiles(0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
+    }
+    else
+    {
+        header.compression() = ZIP_COMPRESSION;
+        OutputFile file(filename.c_str(), header);
+        file.setFrameBuffer(frame_buffer);
+        file.writePixels(test.height);
+    }
+}
+
+// Check the TIFF against the EXR it was converted from.  Return the number of mismatches.
+static int check_tiff(const string &filename, const TestCase &test)
+{
+    const ConvertOptions &options = test.options;
+    int x0 = 0, y0 = 0, width = test.width, height = test.height;
+    if(options.crop_width > 0)
+    {
+        x0 = max(options.crop_x, 0);
+        y0 = max(options.crop_y, 0);
+        width = min(options.crop_x + options.crop_width, test.width) - x0;
+        height = min(options.crop_y + options.crop_height, test.height) - y0;
+    }
+
+    TIFF *tif = TIFFOpen(filename.c_str(), "r");
+    if(tif == NULL)
+    {
+        printf("%s: couldn't open the output\n", test.name);
+        return 1;
+    }
+
+    uint32 tiff_width = 0, tiff_height = 0;
+    uint16 channels = 0, bits = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+    TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &channels);
+    TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+    if((int) tiff_width != width || (int) tiff_height != height || channels != 3 || bits != 32)
+    {
+        printf("%s: output is %ix%i with %i %i-bit channels, expected %ix%i with 3 32-bit channels\n",
+            test.name, tiff_width, tiff_height, channels, bits, width, height);
+        TIFFClose(tif);
+        return 1;
+    }
+
+    int errors = 0;
+    vector<float> row(width * 3);
+    for(int y = 0; y < height && errors < 10; ++y)
+    {
+        if(TIFFReadScanline(tif, row.data(), y, 0) < 0)
+        {
+            printf("%s: error reading row %i\n", test.name, y);
+            errors++;
+            break;
+        }
+
+        for(int x = 0; x < width; ++x)
+        {
+            for(int c = 0; c < 3; ++c)
+            {
+                float expected = pixel_value(x0 + x, y0 + y, c);
+                if(row[x*3 + c] != expected && errors++ < 10)
+                    printf("%s: pixel %i,%i channel %i is %g, expected %g\n", test.name, x, y, c, row[x*3 + c], expected);
+            }
+        }
+    }
+
+    TIFFClose(tif);
+    return errors;
+}
+
+int main()
+{
+    char dir[] = "/tmp/exrtotiff-test-XXXXXX";
+    if(mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    auto make_test = [](const char *name, PixelType type, int tile_size) {
+        TestCase test;
+        test.name = name;
+        test.type = type;
+        test.width = 301;
+        test.height = 203;
+        test.tile_size = tile_size;
+        test.options.rows_per_strip = 5;
+        return test;
+    };
+
+    vector<TestCase> tests;
+    tests.push_back(make_test("scanline", FLOAT, 0));
+    tests.push_back(make_test("scanline half", HALF, 0));
+
+    TestCase scanline_crop = make_test("scanline crop", FLOAT, 0);
+    scanline_crop.options.crop_x = 17;
+    scanline_crop.options.crop_y = 9;
+    scanline_crop.options.crop_width = 150;
+    scanline_crop.options.crop_height = 100;
+    tests.push_back(scanline_crop);
+
+    // Tiles are 64 rows and strips 5, which only line up every 320 rows, so blocks are
+    // whole strips and end partway through tiles.
+    tests.push_back(make_test("tiled", FLOAT, 64));
+    tests.push_back(make_test("tiled half", HALF, 64));
+
+    TestCase tiled_serial = make_test("tiled serial", FLOAT, 64);
+    tiled_serial.options.encode_threads = 1;
+    tests.push_back(tiled_serial);
+
+    TestCase tiled_small_blocks = make_test("tiled small blocks", FLOAT, 64);
+    tiled_small_blocks.options.block_rows = 1;
+    tests.push_back(tiled_small_blocks);
+
+    // 64-row tiles and 7-row strips only line up every 448 rows, so blocks are rounded to
+    // whole strips and some tiles are read by two blocks.
+    TestCase tiled_odd_strips = make_test("tiled odd strips", FLOAT, 64);
+    tiled_odd_strips.options.rows_per_strip = 7;
+    tests.push_back(tiled_odd_strips);
+
+    // Crops that end partway through a row of tiles, and that start partway through one.
+    // Reads cover whole tiles, so they cover more rows than the block.
+    TestCase crop_end = make_test("tiled crop end", FLOAT, 64);
+    crop_end.options.crop_width = 301;
+    crop_end.options.crop_height = 100;
+    tests.push_back(crop_end);
+
+    TestCase crop_inside = make_test("tiled crop inside", FLOAT, 64);
+    crop_inside.options.crop_x = 10;
+    crop_inside.options.crop_y = 30;
+    crop_inside.options.crop_width = 50;
+    crop_inside.options.crop_height = 70;
+    tests.push_back(crop_inside);
+
+    // A crop starting 30 rows into a 64-row tile, with 2-row strips, so the first block is
+    // 34 rows and the rest start on tile boundaries.
+    TestCase crop_off_grid = make_test("tiled crop off grid", FLOAT, 64);
+    crop_off_grid.options.rows_per_strip = 2;
+    crop_off_grid.options.crop_x = 0;
+    crop_off_grid.options.crop_y = 30;
+    crop_off_grid.options.crop_width = 301;
+    crop_off_grid.options.crop_height = 173;
+    tests.push_back(crop_off_grid);
+
+    int failures = 0;
+    for(TestCase &test: tests)
+    {
+        string input = string(dir) + "/input.exr", output = string(dir) + "/output.tif";
+        int errors = 0;
+        try {
+            write_exr(input, test);
+            convert(input, output, test.options);
+            errors = check_tiff(output, test);
+        } catch(exception &e) {
+            printf("%s: %s\n", test.name, e.what());
+            errors = 1;
+        }
+
+        printf("%s %s\n", errors? "FAILED":"ok    ", test.name);
+        failures += errors != 0;
+        unlink(input.c_str());
+        unlink(output.c_str());
+    }
+
+    rmdir(dir);
+    printf("%i of %i tests passed\n", int(tests.size()) - failures, int(tests.size()));
+    return failures? 1: 0;
+}
@@ -0,0 +1,291 @@
+// This file is in the public domain.
+//
+// Check that every vector row converter the CPU supports gives exactly the same output as
+// the scalar one, for every layout and row length, and doesn't write past the row.  Also
+// check quantization against known values, and that quantizing HALF input through its
+// lookup table gives the same result as converting it to float first.
+#include "interleave.h"
+#include <half.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+using namespace exrtotiff;
+
+static const char *isa_names[] = { "scalar", "sse2", "avx2", "avx512" };
+static const char *sample_names[] = { "float32", "float16", "uint8", "uint16" };
+
+static int sample_bytes(SampleType type)
+{
+    switch(type)
+    {
+    case SAMPLE_FLOAT32: return 4;
+    case SAMPLE_FLOAT16: return 2;
+    case SAMPLE_UINT8: return 1;
+    case SAMPLE_UINT16: return 2;
+    }
+    return 0;
+}
+
+// Fill a plane with random samples.  FLOAT planes get any bit pattern, including NaNs,
+// infinities and denormals, with some ordinary values mixed in.  HALF planes get any
+// value except NaN: F16C quiets signaling NaNs and OpenEXR's table doesn't, and neither
+// is wrong.
+static void fill_plane(vector<char> &plane, SampleType type, int count)
+{
+    plane.resize(count * sample_bytes(type));
+    for(int x = 0; x < count; ++x)
+    {
+        if(type == SAMPLE_FLOAT32)
+        {
+            unsigned bits = rand() ^ (rand() << 16);
+            float v;
+            memcpy(&v, &bits, sizeof(v));
+            if(rand() % 4 == 0)
+                v = (rand() % 2000 - 1000) / 500.0f;
+            memcpy(&plane[x * sizeof(v)], &v, sizeof(v));
+        }
+        else
+        {
+            unsigned short bits;
+            do {
+                bits = rand();
+            } while((bits & 0x7c00) == 0x7c00 && (bits & 0x3ff) != 0);
+            half v;
+            v.setBits(bits);
+            memcpy(&plane[x * sizeof(v)], &v, sizeof(v));
+        }
+    }
+}
+
+// Check Quantizer::quantize against values worked out by hand.  Return the number of
+// failures.
+static int check_quantize()
+{
+    struct Case
+    {
+        int bits;
+        TransferCurve curve;
+        bool alpha;
+        float value;
+        int expected;
+    };
+
+    const Case cases[] = {
+        // Clamping.  NaN and negative values become 0.
+        { 8, TRANSFER_LINEAR, false, 0, 0 },
+        { 8, TRANSFER_LINEAR, false, -0.5f, 0 },
+        { 8, TRANSFER_LINEAR, false, -INFINITY, 0 },
+        { 8, TRANSFER_LINEAR, false, NAN, 0 },
+        { 8, TRANSFER_LINEAR, false, 1, 255 },
+        { 8, TRANSFER_LINEAR, false, 2, 255 },
+        { 8, TRANSFER_LINEAR, false, INFINITY, 255 },
+        { 16, TRANSFER_LINEAR, false, 1, 65535 },
+        { 16, TRANSFER_SRGB, false, NAN, 0 },
+        { 16, TRANSFER_SRGB, false, 1.5f, 65535 },
+
+        // Rounding to nearest.
+        { 8, TRANSFER_LINEAR, false, 0.25f / 255, 0 },
+        { 8, TRANSFER_LINEAR, false, 0.75f / 255, 1 },
+        { 8, TRANSFER_LINEAR, false, 0.5f, 128 },
+        { 16, TRANSFER_LINEAR, false, 0.5f, 32768 },
+
+        // Curves, on both sides of the linear segment at the bottom.  18% grey is 118 in
+        // sRGB.
+        { 8, TRANSFER_SRGB, false, 0.002f, 7 },
+        { 8, TRANSFER_SRGB, false, 0.18f, 118 },
+        { 8, TRANSFER_SRGB, false, 0.5f, 188 },
+        { 8, TRANSFER_REC709, false, 0.01f, 11 },
+        { 8, TRANSFER_REC709, false, 0.5f, 180 },
+        { 8, TRANSFER_GAMMA, false, 0.5f, 186 },
+
+        // Alpha is always linear.
+        { 8, TRANSFER_SRGB, true, 0.18f, 46 },
+        { 8, TRANSFER_GAMMA, true, 0.5f, 128 },
+    };
+
+    int failures = 0;
+    for(const Case &test: cases)
+    {
+        Quantizer quantizer;
+        quantizer.bits = test.bits;
+        quantizer.curve = test.curve;
+        int result = quantizer.quantize(test.value, test.alpha);
+        if(result != test.expected)
+        {
+            failures++;
+            printf("FAILED quantize(%g) with %i bits, curve %i, alpha %i: got %i, expected %i\n",
+                test.value, test.bits, test.curve, test.alpha, result, test.expected);
+        }
+    }
+
+    printf("%i of %i quantize values matched\n", int(sizeof(cases) / sizeof(cases[0])) - failures, int(sizeof(cases) / sizeof(cases[0])));
+    return failures;
+}
+
+// Check that HALF input, which is quantized through half_quantize_table, gives the same
+// output as the same values as FLOAT input, for every half value.  Also spot check a few
+// table entries.  Return the number of failures.
+static int check_half_tables()
+{
+    const TransferCurve curves[] = { TRANSFER_LINEAR, TRANSFER_SRGB, TRANSFER_REC709, TRANSFER_GAMMA };
+
+    // A color plane and an alpha plane with every half value, and the same as floats.
+    vector<half> half_plane(65536);
+    vector<float> float_plane(65536);
+    for(int bits = 0; bits < 65536; ++bits)
+    {
+        half_plane[bits].setBits(bits);
+        float_plane[bits] = half_plane[bits];
+    }
+
+    int checked = 0, failures = 0;
+    for(int bits = 8; bits <= 16; bits += 8)
+    for(TransferCurve curve: curves)
+    for(int normals = 0; normals < 2; ++normals)
+    {
+        Quantizer quantizer;
+        quantizer.bits = bits;
+        quantizer.curve = curve;
+        RowParams params;
+        params.quantizer = &quantizer;
+        params.color_table = half_quantize_table(quantizer, normals, false);
+        params.alpha_table = half_quantize_table(quantizer, normals, true);
+
+        SampleType output = bits == 8? SAMPLE_UINT8: SAMPLE_UINT16;
+        RowConverter from_half = row_converter_scalar(2, true, normals, SAMPLE_FLOAT16, output);
+        RowConverter from_float = row_converter_scalar(2, true, normals, SAMPLE_FLOAT32, output);
+        const void *half_planes[] = { half_plane.data(), half_plane.data() };
+        const void *float_planes[] = { float_plane.data(), float_plane.data() };
+
+        size_t row_bytes = 65536 * 2 * sample_bytes(output);
+        vector<char> expected(row_bytes), result(row_bytes);
+        from_float(float_planes, 65536, expected.data(), params);
+        from_half(half_planes, 65536, result.data(), params);
+        checked++;
+
+        if(expected != result)
+        {
+            failures++;
+            printf("FAILED half table for %i bits, curve %i, normals %i doesn't match float\n", bits, curve, normals);
+        }
+    }
+
+    // Half 0.5 is 0x3800, and 0 is 0.
+    struct Entry
+    {
+        TransferCurve curve;
+        bool normals, alpha;
+        int half_bits, expected;
+    };
+
+    const Entry entries[] = {
+        { TRANSFER_LINEAR, false, false, 0x3800, 128 },
+        { TRANSFER_SRGB, false, false, 0x3800, 188 },
+        { TRANSFER_SRGB, false, true, 0x3800, 128 },
+        { TRANSFER_LINEAR, true, false, 0, 128 },
+        { TRANSFER_LINEAR, true, true, 0, 128 },
+        { TRANSFER_LINEAR, false, false, 0xbc00, 0 },
+    };
+
+    for(const Entry &entry: entries)
+    {
+        Quantizer quantizer;
+        quantizer.bits = 8;
+        quantizer.curve = entry.curve;
+        int result = half_quantize_table(quantizer, entry.normals, entry.alpha)[entry.half_bits];
+        checked++;
+        if(result != entry.expected)
+        {
+            failures++;
+            printf("FAILED half table entry %04x for curve %i, normals %i, alpha %i: got %i, expected %i\n",
+                entry.half_bits, entry.curve, entry.normals, entry.alpha, result, entry.expected);
+        }
+    }
+
+    printf("%i of %i half table checks passed\n", checked - failures, checked);
+    return failures;
+}
+
+int main()
+{
+    const SampleType conversions[][2] = {
+        { SAMPLE_FLOAT32, SAMPLE_FLOAT32 },
+        { SAMPLE_FLOAT16, SAMPLE_FLOAT32 },
+        { SAMPLE_FLOAT16, SAMPLE_FLOAT16 },
+        { SAMPLE_FLOAT32, SAMPLE_FLOAT16 },
+        { SAMPLE_FLOAT16, SAMPLE_UINT8 },
+        { SAMPLE_FLOAT16, SAMPLE_UINT16 },
+        { SAMPLE_FLOAT32, SAMPLE_UINT8 },
+        { SAMPLE_FLOAT32, SAMPLE_UINT16 },
+    };
+
+    // The guard bytes after each row, which must be left alone.
+    const int guard = 64;
+
+    srand(1);
+    int checked = 0, failures = 0;
+    for(const auto &conversion: conversions)
+    {
+        SampleType input = conversion[0], output = conversion[1];
+        Quantizer quantizer;
+        quantizer.bits = output == SAMPLE_UINT8? 8: 16;
+        quantizer.curve = TRANSFER_SRGB;
+
+        for(int channels = 1; channels <= 4; ++channels)
+        for(int has_alpha = 0; has_alpha < 2; ++has_alpha)
+        for(int normals = 0; normals < 2; ++normals)
+        {
+            RowParams params;
+            params.quantizer = &quantizer;
+            params.color_table = half_quantize_table(quantizer, normals, false);
+            params.alpha_table = half_quantize_table(quantizer, normals, true);
+
+            RowConverter scalar = row_converter_scalar(channels, has_alpha, normals, input, output);
+            for(int isa = ISA_SSE2; isa <= ISA_AVX512; ++isa)
+            {
+                RowConverter convert = row_converter_for_isa(Isa(isa), channels, has_alpha, normals, input, output);
+                // Conversions without a vector version use the scalar one, which there's
+                // no point comparing with itself.
+                if(convert == NULL || convert == scalar)
+                    continue;
+
+                // Test every row length up to a few vectors, so every tail length is
+                // covered, with and without a plane fanned out to every channel.
+                for(int count = 0; count <= 80; ++count)
+                for(int fan_out = 0; fan_out < 2; ++fan_out)
+                {
+                    vector<vector<char>> planes(channels);
+                    const void *row_planes[4];
+                    for(int c = 0; c < channels; ++c)
+                    {
+                        fill_plane(planes[c], input, count);
+                        row_planes[c] = planes[fan_out? 0: c].data();
+                    }
+
+                    size_t row_bytes = count * channels * sample_bytes(output);
+                    vector<char> expected(row_bytes + guard, 0x55), result(row_bytes + guard, 0x55);
+                    scalar(row_planes, count, expected.data(), params);
+                    convert(row_planes, count, result.data(), params);
+                    checked++;
+
+                    if(expected != result)
+                    {
+                        failures++;
+                        printf("FAILED %s %s to %s: %i channels, alpha %i, normals %i, fan out %i, %i pixels\n",
+                            isa_names[isa], sample_names[input], sample_names[output],
+                            channels, has_alpha, normals, fan_out, count);
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%i of %i rows matched the scalar converter (%s CPU)\n", checked - failures, checked, row_converter_name());
+
+    failures += check_quantize();
+    failures += check_half_tables();
+    return failures? 1: 0;
+}
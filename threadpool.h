@@ -0,0 +1,109 @@
+// This file is in the public domain.
+#ifndef EXRTOTIFF_THREADPOOL_H
+#define EXRTOTIFF_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace exrtotiff
+{
+
+// A simple fixed-size pool of worker threads.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int thread_count)
+    {
+        for(int i = 0; i < thread_count; ++i)
+            threads.push_back(std::thread([this] { worker(); }));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto &t: threads)
+            t.join();
+    }
+
+    int size() const { return threads.size(); }
+
+    // Run task(0) through task(count-1) on the pool, and return when they've all finished.
+    // If any task throws, the first exception is rethrown here once the rest have finished.
+    void parallel_for(int count, std::function<void(int)> task)
+    {
+        std::mutex done_lock;
+        std::condition_variable done;
+        int remaining = count;
+        std::exception_ptr error;
+
+        for(int i = 0; i < count; ++i)
+        {
+            run([&, i] {
+                std::exception_ptr task_error;
+                try {
+                    task(i);
+                } catch(...) {
+                    task_error = std::current_exception();
+                }
+
+                std::unique_lock<std::mutex> guard(done_lock);
+                if(task_error && !error)
+                    error = task_error;
+                if(--remaining == 0)
+                    done.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> guard(done_lock);
+        done.wait(guard, [&] { return remaining == 0; });
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // Queue a task to run on the pool.
+    void run(std::function<void()> task)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            queue.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+private:
+    void worker()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] { return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+};
+
+}
+
+#endif